@@ -15,9 +15,20 @@
  * Holding down any key from 1 to 0 and star will select the tone mode
  * corresponding to that key.  This setting is lost when the bluebox is
  * switched off.  To set the powerup mode, first hold 2600 and then press
- * the key for the desired tone mode.  The star key will toggle between
+ * the key for the desired tone mode.  The hash key will toggle between
  * fast (75ms) or slow (120ms) tone durations for MF and
- * DTMF modes.  This can also be saved as a powerup default.
+ * DTMF modes.  This can also be saved as a powerup default.  The star
+ * key steps the output level down by 4 dB, wrapping around to full
+ * volume after the quietest of the four levels.  This can be saved
+ * as a powerup default too.  Keys 6 through 9 choose the timing profile
+ * for the powerup tone mode: spec minimum, conservative, custom or
+ * standard.  Stored sequences use the profile of their tone mode unless
+ * they name their own.
+ *
+ * Holding 0 at powerup selects trunk mode, which stands in for the far
+ * end of an SF trunk.  It sends 2600 continuously while idle.  Key 1
+ * seizes (drops the tone), 2 returns to idle, 3 winks and 4 sends a
+ * timed disconnect.
  *
  * To toggle to or from playback mode, press and hold the 2600 key for
  * two seconds.  A low-high chirp will be played when going into
@@ -33,10 +44,16 @@
  * you can have an MF sequence in one memory, a DTMF sequence in another
  * and so on.  Sequences cannot be saved when in playback mode.
  *
+ * To redial what's in the keystroke buffer without saving it, tap 2600
+ * twice, letting go quickly each time.  The buffer is played in the
+ * current tone mode and kept for next time.
+ *
  * To play back a sequence, first toggle the bluebox into playback mode.
  * Then press the key for the desired memory location.  The sequence
  * will then be played back using the tone mode the bluebox was in when
- * the sequence was saved.
+ * the sequence was saved.  A sequence may also carry escape codes that
+ * switch tone mode or tone length partway through, pause, or play
+ * another memory location as part of this one (see SEQ_ESCAPE).
  *
  * To clear a memory location, first clear the keystroke buffer.  This
  * happens when the bluebox is turned on and when toggling out of playback
@@ -84,8 +101,17 @@
  *
  * http://www.daycounter.com/Calculators/Sine-Generator-Calculator.phtml
  *
+ * There is one table for each output level.  The quieter ones are the
+ * full-scale table scaled by 4 dB steps about SINE_MIDPOINT and
+ * rounded.  Scaling the table rather than the output keeps the timer
+ * interrupt the same length at every level, since there's no hardware
+ * multiplier.
+ *
  */
-const unsigned char sine_table[] PROGMEM = {
+#define VOLUME_LEVELS	4
+#ifndef SIGMA_DELTA
+const unsigned char sine_table[VOLUME_LEVELS][256] PROGMEM = {
+{	/* 0 dB */
 0x80,0x83,0x86,0x89,0x8c,0x8f,0x92,0x95,
 0x98,0x9b,0x9e,0xa2,0xa5,0xa7,0xaa,0xad,
 0xb0,0xb3,0xb6,0xb9,0xbc,0xbe,0xc1,0xc4,
@@ -118,7 +144,150 @@ const unsigned char sine_table[] PROGMEM = {
 0x39,0x3b,0x3e,0x41,0x43,0x46,0x49,0x4c,
 0x4f,0x52,0x55,0x58,0x5a,0x5d,0x61,0x64,
 0x67,0x6a,0x6d,0x70,0x73,0x76,0x79,0x7c
+}, {	/* -4 dB */
+0x80,0x82,0x84,0x86,0x88,0x89,0x8b,0x8d,
+0x8f,0x91,0x93,0x95,0x97,0x99,0x9b,0x9c,
+0x9e,0xa0,0xa2,0xa4,0xa6,0xa7,0xa9,0xab,
+0xac,0xae,0xaf,0xb1,0xb2,0xb4,0xb6,0xb7,
+0xb9,0xba,0xbb,0xbd,0xbe,0xbf,0xc0,0xc2,
+0xc3,0xc4,0xc5,0xc5,0xc7,0xc7,0xc9,0xc9,
+0xca,0xca,0xcc,0xcc,0xcd,0xcd,0xce,0xce,
+0xcf,0xcf,0xd0,0xd0,0xd0,0xd0,0xd0,0xd0,
+0xd0,0xd0,0xd0,0xd0,0xd0,0xd0,0xd0,0xcf,
+0xcf,0xce,0xce,0xcd,0xcd,0xcc,0xcc,0xca,
+0xca,0xc9,0xc9,0xc7,0xc7,0xc5,0xc5,0xc4,
+0xc3,0xc2,0xc0,0xbf,0xbe,0xbd,0xbb,0xba,
+0xb9,0xb7,0xb6,0xb4,0xb2,0xb1,0xaf,0xae,
+0xac,0xab,0xa9,0xa7,0xa6,0xa4,0xa2,0xa0,
+0x9e,0x9c,0x9b,0x99,0x97,0x95,0x93,0x91,
+0x8f,0x8d,0x8b,0x89,0x88,0x86,0x84,0x82,
+0x80,0x7d,0x7c,0x7a,0x78,0x76,0x74,0x72,
+0x70,0x6e,0x6c,0x6a,0x68,0x67,0x65,0x63,
+0x61,0x5f,0x5d,0x5b,0x5a,0x58,0x56,0x54,
+0x53,0x51,0x50,0x4e,0x4d,0x4b,0x4a,0x48,
+0x47,0x45,0x44,0x43,0x42,0x40,0x3f,0x3e,
+0x3c,0x3c,0x3b,0x3a,0x39,0x38,0x37,0x36,
+0x36,0x35,0x34,0x33,0x32,0x32,0x32,0x31,
+0x30,0x30,0x30,0x30,0x30,0x2f,0x2f,0x2f,
+0x2f,0x2f,0x2f,0x2f,0x30,0x30,0x30,0x30,
+0x30,0x31,0x32,0x32,0x32,0x33,0x34,0x35,
+0x36,0x36,0x37,0x38,0x39,0x3a,0x3b,0x3c,
+0x3c,0x3e,0x3f,0x40,0x42,0x43,0x44,0x45,
+0x47,0x48,0x4a,0x4b,0x4d,0x4e,0x50,0x51,
+0x53,0x54,0x56,0x58,0x5a,0x5b,0x5d,0x5f,
+0x61,0x63,0x65,0x67,0x68,0x6a,0x6c,0x6e,
+0x70,0x72,0x74,0x76,0x78,0x7a,0x7c,0x7d
+}, {	/* -8 dB */
+0x80,0x81,0x82,0x84,0x85,0x86,0x87,0x88,
+0x8a,0x8b,0x8c,0x8e,0x8f,0x90,0x91,0x92,
+0x93,0x94,0x95,0x97,0x98,0x99,0x9a,0x9b,
+0x9c,0x9d,0x9e,0x9f,0xa0,0xa1,0xa2,0xa3,
+0xa4,0xa5,0xa5,0xa6,0xa7,0xa8,0xa9,0xa9,
+0xaa,0xab,0xab,0xac,0xad,0xad,0xae,0xae,
+0xaf,0xaf,0xb0,0xb0,0xb1,0xb1,0xb1,0xb1,
+0xb2,0xb2,0xb2,0xb2,0xb2,0xb3,0xb3,0xb3,
+0xb3,0xb3,0xb3,0xb3,0xb2,0xb2,0xb2,0xb2,
+0xb2,0xb1,0xb1,0xb1,0xb1,0xb0,0xb0,0xaf,
+0xaf,0xae,0xae,0xad,0xad,0xac,0xab,0xab,
+0xaa,0xa9,0xa9,0xa8,0xa7,0xa6,0xa5,0xa5,
+0xa4,0xa3,0xa2,0xa1,0xa0,0x9f,0x9e,0x9d,
+0x9c,0x9b,0x9a,0x99,0x98,0x97,0x95,0x94,
+0x93,0x92,0x91,0x90,0x8f,0x8e,0x8c,0x8b,
+0x8a,0x88,0x87,0x86,0x85,0x84,0x82,0x81,
+0x80,0x7e,0x7d,0x7c,0x7b,0x7a,0x78,0x77,
+0x76,0x75,0x74,0x72,0x71,0x70,0x6f,0x6e,
+0x6c,0x6b,0x6a,0x69,0x68,0x67,0x66,0x65,
+0x64,0x63,0x62,0x61,0x60,0x5f,0x5e,0x5d,
+0x5c,0x5b,0x5a,0x59,0x59,0x58,0x57,0x56,
+0x55,0x55,0x54,0x54,0x53,0x53,0x52,0x51,
+0x51,0x51,0x50,0x4f,0x4f,0x4f,0x4f,0x4e,
+0x4e,0x4e,0x4d,0x4d,0x4d,0x4d,0x4d,0x4d,
+0x4d,0x4d,0x4d,0x4d,0x4d,0x4d,0x4d,0x4e,
+0x4e,0x4e,0x4f,0x4f,0x4f,0x4f,0x50,0x51,
+0x51,0x51,0x52,0x53,0x53,0x54,0x54,0x55,
+0x55,0x56,0x57,0x58,0x59,0x59,0x5a,0x5b,
+0x5c,0x5d,0x5e,0x5f,0x60,0x61,0x62,0x63,
+0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x6b,
+0x6c,0x6e,0x6f,0x70,0x71,0x72,0x74,0x75,
+0x76,0x77,0x78,0x7a,0x7b,0x7c,0x7d,0x7e
+}, {	/* -12 dB */
+0x80,0x81,0x82,0x82,0x83,0x84,0x85,0x85,
+0x86,0x87,0x88,0x89,0x89,0x8a,0x8b,0x8b,
+0x8c,0x8d,0x8e,0x8e,0x8f,0x90,0x90,0x91,
+0x92,0x92,0x93,0x94,0x94,0x95,0x95,0x96,
+0x97,0x97,0x98,0x98,0x99,0x99,0x9a,0x9a,
+0x9b,0x9b,0x9b,0x9c,0x9c,0x9c,0x9d,0x9d,
+0x9d,0x9e,0x9e,0x9e,0x9f,0x9f,0x9f,0x9f,
+0x9f,0x9f,0xa0,0xa0,0xa0,0xa0,0xa0,0xa0,
+0xa0,0xa0,0xa0,0xa0,0xa0,0xa0,0xa0,0x9f,
+0x9f,0x9f,0x9f,0x9f,0x9f,0x9e,0x9e,0x9e,
+0x9d,0x9d,0x9d,0x9c,0x9c,0x9c,0x9b,0x9b,
+0x9b,0x9a,0x9a,0x99,0x99,0x98,0x98,0x97,
+0x97,0x96,0x95,0x95,0x94,0x94,0x93,0x92,
+0x92,0x91,0x90,0x90,0x8f,0x8e,0x8e,0x8d,
+0x8c,0x8b,0x8b,0x8a,0x89,0x89,0x88,0x87,
+0x86,0x85,0x85,0x84,0x83,0x82,0x82,0x81,
+0x80,0x7f,0x7e,0x7d,0x7d,0x7c,0x7b,0x7a,
+0x7a,0x79,0x78,0x77,0x76,0x76,0x75,0x74,
+0x74,0x73,0x72,0x71,0x71,0x70,0x6f,0x6f,
+0x6e,0x6d,0x6d,0x6c,0x6c,0x6b,0x6a,0x6a,
+0x69,0x69,0x68,0x68,0x67,0x67,0x66,0x66,
+0x65,0x65,0x64,0x64,0x64,0x63,0x63,0x63,
+0x62,0x62,0x62,0x61,0x61,0x61,0x61,0x61,
+0x60,0x60,0x60,0x60,0x60,0x60,0x60,0x60,
+0x60,0x60,0x60,0x60,0x60,0x60,0x60,0x60,
+0x60,0x61,0x61,0x61,0x61,0x61,0x62,0x62,
+0x62,0x63,0x63,0x63,0x64,0x64,0x64,0x65,
+0x65,0x66,0x66,0x67,0x67,0x68,0x68,0x69,
+0x69,0x6a,0x6a,0x6b,0x6c,0x6c,0x6d,0x6d,
+0x6e,0x6f,0x6f,0x70,0x71,0x71,0x72,0x73,
+0x74,0x74,0x75,0x76,0x76,0x77,0x78,0x79,
+0x7a,0x7a,0x7b,0x7c,0x7d,0x7d,0x7e,0x7f
+}
+};
+#else
+/*
+ * For the sigma-delta output, one signed table with 7 fraction bits
+ * below the 8-bit output's LSB.  The peak is 125.5 LSBs rather than
+ * 127.5 to leave the modulator room to swing past a full-scale sample.
+ * Unlike the table above, exactly one cycle spans the 255 entries the
+ * timer interrupt actually uses.
+ */
+const int16_t sine_table16[256] PROGMEM = {
+0,396,791,1186,1581,1974,2366,2757,
+3146,3533,3918,4301,4681,5058,5432,5803,
+6170,6534,6893,7249,7600,7946,8288,8624,
+8956,9281,9602,9916,10224,10526,10822,11111,
+11394,11669,11938,12199,12453,12699,12938,13168,
+13391,13606,13812,14010,14199,14380,14552,14715,
+14869,15015,15151,15278,15395,15504,15603,15692,
+15772,15842,15903,15954,15995,16027,16049,16061,
+16064,16056,16039,16013,15976,15930,15874,15808,
+15733,15649,15554,15451,15338,15215,15084,14943,
+14793,14635,14467,14291,14105,13912,13710,13499,
+13281,13054,12819,12577,12327,12069,11805,11533,
+11254,10968,10675,10376,10071,9760,9442,9119,
+8791,8457,8118,7774,7425,7072,6714,6353,
+5987,5618,5246,4870,4491,4110,3726,3340,
+2952,2562,2170,1778,1384,989,594,198,
+-198,-594,-989,-1384,-1778,-2170,-2562,-2952,
+-3340,-3726,-4110,-4491,-4870,-5246,-5618,-5987,
+-6353,-6714,-7072,-7425,-7774,-8118,-8457,-8791,
+-9119,-9442,-9760,-10071,-10376,-10675,-10968,-11254,
+-11533,-11805,-12069,-12327,-12577,-12819,-13054,-13281,
+-13499,-13710,-13912,-14105,-14291,-14467,-14635,-14793,
+-14943,-15084,-15215,-15338,-15451,-15554,-15649,-15733,
+-15808,-15874,-15930,-15976,-16013,-16039,-16056,-16064,
+-16061,-16049,-16027,-15995,-15954,-15903,-15842,-15772,
+-15692,-15603,-15504,-15395,-15278,-15151,-15015,-14869,
+-14715,-14552,-14380,-14199,-14010,-13812,-13606,-13391,
+-13168,-12938,-12699,-12453,-12199,-11938,-11669,-11394,
+-11111,-10822,-10526,-10224,-9916,-9602,-9281,-8956,
+-8624,-8288,-7946,-7600,-7249,-6893,-6534,-6170,
+-5803,-5432,-5058,-4681,-4301,-3918,-3533,-3146,
+-2757,-2366,-1974,-1581,-1186,-791,-396,0
 };
+#endif
 
 #define TRUE	1
 #define FALSE	0
@@ -139,23 +308,122 @@ const unsigned char sine_table[] PROGMEM = {
 #define MODE_REDBOX	0x02
 #define MODE_GREENBOX	0x03
 #define MODE_PULSE	0x04
+#define MODE_TRUNK	0x05
 #define MODE_MIN	MODE_MF
-#define MODE_MAX	MODE_PULSE
+#define MODE_MAX	MODE_TRUNK
+
+/*
+ * Key codes never use the high bit, so a stored sequence may contain
+ * escape codes that change the tone mode or tone length partway
+ * through playback.  This lets one memory hold something like a 2600
+ * pulse seizure followed by MF digits followed by DTMF.
+ *
+ *   0x80 - 0x85	switch tone mode (SEQ_MODE | MODE_*)
+ *   0x90 - 0x9B	play memory location (code & SEQ_CALL_MASK), in key2chunk()
+ *			order, then carry on with this one
+ *   0xA1 - 0xBF	pause for (code & SEQ_PAUSE_MASK) * 100 ms
+ *   0xC0		restore the timing profile's tone length and gap
+ *   0xC1 - 0xFE	set tone length and gap to (code & SEQ_ARG_MASK) * 5 ms
+ *
+ * 0xFF is still the end-of-sequence marker.
+ *
+ * A location played from another one uses its own tone mode and
+ * profile, and the caller's come back afterwards.  Calls nest at most
+ * SEQ_CALL_DEPTH deep, and a call to a location that is already
+ * playing is skipped, so a loop in the phonebook can't run forever.
+ */
+#define SEQ_ESCAPE	0x80
+#define SEQ_OP_MASK	0xC0
+#define SEQ_ARG_MASK	0x3F
+#define SEQ_MODE	0x80
+#define SEQ_LENGTH	0xC0
+#define SEQ_LENGTH_UNIT	5
+#define SEQ_CALL	0x90
+#define SEQ_CALL_OP_MASK	0xF0
+#define SEQ_CALL_MASK	0x0F
+#define SEQ_CALL_DEPTH	3
+#define SEQ_PAUSE	0xA0
+#define SEQ_PAUSE_OP_MASK	0xE0
+#define SEQ_PAUSE_MASK	0x1F
+#define SEQ_PAUSE_UNIT	100
+#define SEQ_SLOTS	12
+
+/*
+ * The first byte of a stored sequence may also name a timing profile
+ * in its high nibble.  Zero there, as in every sequence recorded from
+ * the keypad, means use whatever profile the tone mode has.
+ */
+#define SEQ_MODE_MASK		0x0F
+#define SEQ_PROFILE_SHIFT	4
 
 #define SEIZE_LENGTH	1000
 #define SEIZE_PAUSE	1500
-#define REDBOX_PAUSE	500
-#define GREENBOX_PAUSE	500
-#define PULSE_PAUSE	500
+#define SIGNAL_PAUSE	500
 
 #define KP_LENGTH	120
 
+/*
+ * Trunk mode plays the far end of an SF trunk: 2600 while idle, none
+ * while seized.  Winks and timed disconnects are counted in samples by
+ * the timer interrupt, so they are exact to the sample and the tone
+ * picks up where it left off.
+ */
+#define TRUNK_WINK		200
+#define TRUNK_DISCONNECT	600
+#define SAMPLES_PER_SEC		(F_CPU / TICKS_PER_CYCLE)
+#define MS_TO_SAMPLES(ms)	((uint32_t)(ms) * SAMPLES_PER_SEC / 1000)
+
+/*
+ * Timing profiles
+ *
+ * Every duration the sequencer may choose comes from the current timing
+ * profile.  The redbox coin tones and greenbox winks are left alone
+ * because their timing is part of the signal.  A tone or gap of zero
+ * follows the fast/slow tone length setting.
+ *
+ * Each tone mode has a profile, two bits apiece in EEPROM_PROFILE_MAP.
+ * Erased EEPROM reads as PROFILE_STANDARD everywhere.  The custom
+ * profile starts as the standard one and takes its digit length, gap
+ * and seize pause from EEPROM when they have been set.
+ *
+ */
+#define PROFILE_SPEC		0	/* Shortest MF allows */
+#define PROFILE_CONSERVATIVE	1	/* For slow or sloppy trunks */
+#define PROFILE_CUSTOM		2
+#define PROFILE_STANDARD	3	/* How this bluebox always worked */
+#define PROFILES		4
+#define PROFILE_MASK		0x03
+
+typedef struct {
+	uint16_t tone;		/* MF and DTMF digits */
+	uint16_t gap;		/* after a digit in a sequence */
+	uint16_t kp;		/* MF KP */
+	uint16_t seize;		/* 2600 */
+	uint16_t seize_pause;	/* after 2600 in a sequence */
+	uint8_t  pulse_tone;	/* 2600 on, the break of each dial pulse */
+	uint8_t  pulse_gap;	/* 2600 off, the make between pulses */
+	uint16_t pause;		/* after redbox, greenbox and pulse keys */
+} timing_t;
+
+const timing_t timing_profiles[PROFILES] PROGMEM = {
+	/*
+	 * MF wants 68 +/- 7 ms digits and a 100 ms KP.  DTMF digits
+	 * share the tone length, so they are 61 ms here, not DTMF's own
+	 * 40 ms minimum.
+	 */
+	{  61,  61, 100,  500, 1000, 60, 40, 300 },
+	{ 120, 120, 150, 1500, 2000, 66, 34, 800 },
+	{   0,   0, KP_LENGTH, SEIZE_LENGTH, SEIZE_PAUSE, 66, 34, SIGNAL_PAUSE },
+	{   0,   0, KP_LENGTH, SEIZE_LENGTH, SEIZE_PAUSE, 66, 34, SIGNAL_PAUSE }
+};
+
+#define CUSTOM_SEIZE_PAUSE_UNIT	10
+
 #define SINE_SAMPLES	255UL
 #define TICKS_PER_CYCLE	256UL
 #define SINE_MIDPOINT	0x80	/* After decoupling, this is 0V of the sine. */
 #define STEP_SHIFT	6
 #define SAMPLES_PER_HERTZ_TIMES_256	(SINE_SAMPLES * (TICKS_PER_CYCLE << STEP_SHIFT)) / (F_CPU / 256)
-#define OVERFLOW_PER_MILLISEC (F_CPU / TICKS_PER_CYCLE / 1000)
 
 #define TIMER0_PRESCALE_1	(1<<CS00)
 #define TIMER0_PRESCALE_8	(1<<CS01)
@@ -170,6 +438,109 @@ do { \
 } while (0)
 #define TIMER0_OFF()	TCCR0A &= ~((1<<CS02)|(1<<CS01)|(1<<CS00))
 
+/*
+ * The timer 0 interrupt is only needed while tones are playing.  The
+ * timer itself keeps running so the PWM output sits at SINE_MIDPOINT
+ * between tones instead of jumping to a rail and popping.  TIMSK is
+ * also written by the timer 1 interrupt, so use these in an atomic
+ * block.
+ */
+#define TIMER0_INT_ON()		TIMSK |= (1<<TOIE0)
+#define TIMER0_INT_OFF()	TIMSK &= ~(1<<TOIE0)
+
+/*
+ * Timer 1 keeps time in milliseconds for sleep_ms(), long presses and
+ * chirps, independent of whatever timer 0 is doing for audio.  It runs
+ * in CTC mode, clearing on a match with OCR1C.  F_CPU / 128 isn't a
+ * whole number of counts per millisecond (156.25 at 20 MHz), so the
+ * interrupt stretches some periods by a count to make up the
+ * remainder and keep the average exact.  Only OCR1C moves.  The
+ * interrupt comes from OCR1A, which stays at 0, a count the timer
+ * passes exactly once a period whatever OCR1C is.
+ */
+#define TIMER1_PRESCALE_128		(1<<CS13)
+#define TIMER1_PER_MILLISEC		(F_CPU / 128 / 1000)
+#define TIMER1_PER_MILLISEC_REMAINDER	(F_CPU / 128 % 1000)
+
+/*
+ * Debug telemetry.  With DEBUG_LEVEL above zero, PB1 stops driving the
+ * LEDs and becomes a 1000 baud, 8N1, transmit-only serial line.  The
+ * timer 1 interrupt sends one bit each millisecond, so sending never
+ * holds up the main loop.  The timer 0 interrupt can be held up by a
+ * few dozen cycles, but OCR0A is double buffered, so the samples still
+ * go out on time.
+ *
+ * The stream is a series of records.  Each starts with a byte holding
+ * the record type in the high nibble and the number of bytes that
+ * follow in the low nibble.  Multi-byte values are little-endian.
+ * tools/telemetry.py decodes it from a simavr trace or a logic
+ * analyzer capture.  Records are dropped if the buffer is full.
+ */
+#define TRACE_KEY	0x1	/* key code */
+#define TRACE_PLAY	0x2	/* duration, freq_a, freq_b (uint16_t each) */
+#define TRACE_STORE	0x3	/* key code */
+#define TRACE_PLAYBACK	0x4	/* key code */
+#define TRACE_STATS	0x5	/* worst timer 0 interrupt cycles (uint8_t), */
+				/* stack bytes never used (uint16_t) */
+#define TRACE_VCC	0x6	/* bandgap reading (uint16_t), see BANDGAP_MV */
+#define TRACE_LOAD	0x7	/* tone mode, percent busy, worst main loop */
+				/* latency in timer 1 ticks (uint8_t each) */
+#define TRACE_STATS_INTERVAL	1000	/* ms */
+#define STACK_CANARY	0xC5
+
+#if DEBUG_LEVEL > 0
+#define TRACE(type, data)	trace((type), &(data), sizeof(data))
+#define LED_ON()
+#define LED_OFF()
+#else
+#define TRACE(type, data)
+#define LED_ON()	PORTB |= (1 << PB1)
+#define LED_OFF()	PORTB &= ~(1 << PB1)
+#endif
+
+/*
+ * For measuring the timer interrupt in simavr.  The interrupt writes
+ * which path it took to GPIOR0, which nothing else uses, and clears it
+ * on the way out.  "make sim" traces GPIOR0 and tools/isrcycles.py
+ * turns the trace into cycle counts.  Prologue and epilogue aren't
+ * included.
+ */
+#define CYCLE_BENCH_DONE	0
+#define CYCLE_BENCH_SILENT	1
+#define CYCLE_BENCH_ONE_TONE	2
+#define CYCLE_BENCH_TWO_TONES	3
+#ifdef CYCLE_BENCH
+#define CYCLE_BENCH_MARK(x)	GPIOR0 = (x)
+#else
+#define CYCLE_BENCH_MARK(x)
+#endif
+
+/*
+ * A SCENARIO build writes each scripted key to GPIOR1 as the press
+ * starts, and zero when it ends.  tools/bench.py times from there to
+ * the first tone sample for the key-to-tone latency.
+ */
+#ifdef SCENARIO
+#define SCENARIO_MARK(x)	GPIOR1 = (x)
+#else
+#define SCENARIO_MARK(x)
+#endif
+
+/*
+ * A MICROBENCH build times some of the hot paths at powerup, each
+ * MICROBENCH_REPS times over with the millisecond clock stopped.  The
+ * number of the kernel running is in GPIOR2, and tools/microbench.py
+ * turns the trace into cycles per call, less the empty loop's.
+ */
+#define MICROBENCH_REPS		256
+#define MICROBENCH_LOOP		1
+#define MICROBENCH_ISR		2
+#define MICROBENCH_SET_TONES	3
+#define MICROBENCH_LADDER	4
+#define MICROBENCH_RBUF		5
+#define MICROBENCH_KEY2CHUNK	6
+#define MICROBENCH_LOAD_TIMING	7
+
 #define TONE_LENGTH_FAST	75
 #define TONE_LENGTH_SLOW	120
 
@@ -286,10 +657,38 @@ do { \
 
 #define SEIZE		2600	* MULT2
 
+/*
+ * Supply voltage is checked against the internal 1.1 volt bandgap
+ * reference.  The ADC reference is Vcc, so the lower Vcc gets, the
+ * higher the bandgap reads.  Compare readings rather than converting
+ * to millivolts so there's no division at run time.  The bandgap is
+ * only good to within about 10%, so adjust BANDGAP_MV if a particular
+ * chip reads high or low.
+ *
+ * The keypad doesn't need this.  The ladder runs from Vdd to Vss and
+ * the ADC measures against Vdd, so a given key reads the same no
+ * matter how far the battery has sagged.  What a low battery does
+ * threaten is a 20 MHz part running below its rated 4.5 volts, and
+ * above all an EEPROM write going wrong partway.
+ */
+#define BANDGAP_MV		1100
+#define VCC_TO_BANDGAP(mv)	(BANDGAP_MV * 1024UL / (mv))
+#define VCC_LOW_MV		4400	/* Warn below this. */
+#define VCC_EEPROM_MIN_MV	4200	/* Refuse EEPROM writes below this. */
+#define VCC_CHECK_INTERVAL	10000	/* ms */
+#define ADMUX_LADDER	((1 << ADLAR) | (1 << MUX0))		/* ADC1, PB2 */
+#define ADMUX_BANDGAP	((1 << ADLAR) | (1 << MUX3) | (1 << MUX2))
+
 /* Number of milliseconds to make for a long press. */
 #define LONGPRESS_TIME	2000
+#define SHIFT_TAP_TIME	150	/* Let go of 2600 this soon for a tap. */
+#define SHIFT_TIME	1000	/* A tap's shift lasts this long after. */
 
-/* Two bytes, then 12 chunks of 42 (0x2A) bytes each. */
+/*
+ * Two bytes, then 12 chunks of 42 (0x2A) bytes each, then the volume,
+ * the profile map and the custom profile.  That fills the EEPROM.
+ * The custom bytes are 0xFF until set.
+ */
 #define EEPROM_CHUNK_SIZE			0x2A
 #define EEPROM_STARTUP_TONE_MODE		0x01
 #define EEPROM_STARTUP_TONE_LENGTH		0x02
@@ -305,6 +704,11 @@ do { \
 #define EEPROM_MEM10				EEPROM_MEM9 + EEPROM_CHUNK_SIZE
 #define EEPROM_MEM11				EEPROM_MEM10 + EEPROM_CHUNK_SIZE
 #define EEPROM_MEM12				EEPROM_MEM11 + EEPROM_CHUNK_SIZE
+#define EEPROM_STARTUP_VOLUME			EEPROM_MEM12 + EEPROM_CHUNK_SIZE
+#define EEPROM_PROFILE_MAP			EEPROM_STARTUP_VOLUME + 1
+#define EEPROM_CUSTOM_TONE			EEPROM_PROFILE_MAP + 1	/* 5 ms */
+#define EEPROM_CUSTOM_GAP			EEPROM_CUSTOM_TONE + 1	/* 5 ms */
+#define EEPROM_CUSTOM_SEIZE_PAUSE		EEPROM_CUSTOM_GAP + 1	/* 10 ms */
 
 #define BUFFER_SIZE	EEPROM_CHUNK_SIZE
 
@@ -316,35 +720,97 @@ do { \
 uint8_t ee_data[] EEMEM = {0xff, MODE_MF, TONE_LENGTH_FAST};
 
 uint8_t tone_mode;
-uint8_t tone_length;
+uint16_t tone_length;
+uint8_t volume;
+uint8_t profile_map;
+timing_t timing;
+#ifndef SIGMA_DELTA
+const unsigned char *sine_level = sine_table[0];
+#endif
 bool  playback_mode = FALSE;
-bool  tones_on = FALSE;
+volatile bool tones_on = FALSE;
+bool  single_tone = FALSE;
 
 uint16_t tone_a_step, tone_b_step;
 uint16_t tone_a_place, tone_b_place;
 
 void  init_ports(void);
+void  init_timer1(void);
 void  init_settings(void);
 void  init_adc(void);
 uint8_t getkey(void);
+uint8_t ladder_key(uint8_t);
+#ifdef SCENARIO
+uint8_t scenario_key(void);
+#define SCENARIO_PRESS	100
+#define SCENARIO_HOLD	2500
+#define SCENARIO_SEIZE	400
+#define SCENARIO_GAP	100
+#endif
 void  process_key(uint8_t, bool);
-void  process_longpress(uint8_t);
+void  process_longpress(uint8_t, uint8_t);
+bool  seize_tap(void);
+uint8_t shift_key(uint8_t);
 void  play(uint32_t, uint32_t, uint32_t);
 void  pulse(uint8_t);
+void  trunk(uint8_t);
+void  trunk_tone(void);
+static volatile bool trunk_seized = FALSE;
+static volatile uint16_t gate_samples;
+void  set_tones(uint32_t, uint32_t);
+void  set_volume(uint8_t);
+void  load_timing(uint8_t);
+uint8_t mode_profile(uint8_t);
+void  set_mode_profile(uint8_t, uint8_t);
+static uint8_t profile_shift(uint8_t);
+#ifdef SIGMA_DELTA
+static inline uint8_t sigma_delta(int16_t);
+#endif
+#ifdef FAST_BOOT
+void  chirp(uint16_t, uint32_t, uint32_t);
+static volatile uint16_t chirp_counter;
+#endif
 
 void  sleep_ms(uint16_t ms);
 void  tick(void);
-static uint8_t millisec_counter = OVERFLOW_PER_MILLISEC;
 static volatile uint8_t millisec_flag = FALSE;
 
-static uint16_t	longpress_counter;
+static volatile uint16_t longpress_counter;
 static uint8_t	longpress_on = FALSE;
 static volatile uint8_t longpress_flag = FALSE;
 
+static volatile uint16_t shift_counter;
+static volatile uint8_t shift_on = FALSE;
+
+#ifdef MICROBENCH
+void  microbench(void);
+void  TIM0_OVF_vect(void);	/* called directly by microbench() */
+#endif
+
 void eeprom_store(uint8_t);
+void redial(void);
 void eeprom_playback(uint8_t);
+void play_chunk(uint16_t, uint8_t, uint16_t);
 uint16_t key2chunk(uint8_t);
 
+uint16_t read_bandgap(void);
+bool  vcc_at_least(uint16_t);
+void  check_vcc(void);
+void  low_battery(void);
+static bool vcc_check_due = TRUE;
+
+#if DEBUG_LEVEL > 0
+void  trace(uint8_t, const void *, uint8_t);
+static inline void trace_send(void);
+uint16_t stack_unused(void);
+void  stack_paint(void) __attribute__ ((naked, used, section (".init1")));
+static volatile uint8_t isr_cycles_max;
+static uint16_t idle_spins;		/* sleep_ms() loops this millisecond */
+static uint32_t idle_total;
+static uint16_t idle_full;		/* loops in a millisecond with no load */
+static uint8_t latency_max;
+#endif
+
 
 /* Ring buffer stuff */
 
@@ -359,6 +825,9 @@ typedef struct {
 } rbuf_t;
 
 rbuf_t	rbuf;
+#if DEBUG_LEVEL > 0
+rbuf_t	tbuf;	/* Telemetry waiting to be sent. */
+#endif
 
 static inline void rbuf_init(rbuf_t* const);
 static inline rbuf_count_t rbuf_getcount(rbuf_t* const);
@@ -370,24 +839,82 @@ static inline rbuf_data_t rbuf_remove(rbuf_t* const);
 int main(void)
 {
 	uint8_t key;
+	uint8_t code;
 	bool	startup_set = FALSE;
+#ifdef FAST_BOOT
+	uint16_t startup_freq;
+#endif
 
 	init_ports();
 	init_adc();
+	init_timer1();
 
 	rbuf_init(&rbuf);
+#if DEBUG_LEVEL > 0
+	rbuf_init(&tbuf);
+#endif
 
 	/*
 	 * Start TIMER0
 	 * The timer is counting from 0 to 255 -- 256 values.
 	 * The prescaler is 1.  Therefore our PWM frequency is F_CPU / 256.
+	 * Its interrupt stays off until there's a tone to play.
 	 */
+	OCR0A = SINE_MIDPOINT;
 	TIMER0_ON(TIMER0_PRESCALE_1);
 
+#if DEBUG_LEVEL > 0
+	/*
+	 * Calibrate the load meter while nothing but the millisecond
+	 * clock is running.  The first millisecond lines us up.
+	 */
+	sleep_ms(1);
+	idle_total = 0;
+	sleep_ms(8);
+	idle_full = idle_total / 8;
+	idle_total = 0;
+#endif
+
+#ifdef CYCLE_BENCH
+	/* Give the trace some of each kind of interrupt. */
+	play(20, MF1, MF2);
+	play(20, MF1, MF1);
+#endif
+
+#ifdef MICROBENCH
+	microbench();
+#endif
+
 	/* Read setup bytes. */
 	tone_mode   = eeprom_read_byte(( uint8_t *)EEPROM_STARTUP_TONE_MODE);
 	tone_length = eeprom_read_byte(( uint8_t *)EEPROM_STARTUP_TONE_LENGTH);
+	volume      = eeprom_read_byte(( uint8_t *)EEPROM_STARTUP_VOLUME);
+	profile_map = eeprom_read_byte(( uint8_t *)EEPROM_PROFILE_MAP);
+
+	/*
+	 * The volume byte isn't covered by ee_data, so a freshly
+	 * programmed chip has 0xFF there.  Just use full volume.
+	 */
+	if (volume >= VOLUME_LEVELS)
+		volume = 0;
+	set_volume(volume);
 
+#ifdef FAST_BOOT
+	/*
+	 * Don't hold the user up.  Bogus settings are quietly replaced and
+	 * reported by changing the pitch of the startup tone, which plays
+	 * in the background while the keypad is already being read.
+	 */
+	startup_freq = 440;
+	if (tone_mode < MODE_MIN || tone_mode > MODE_MAX) {
+		tone_mode = MODE_MIN;
+		startup_freq = 880;
+	}
+	if ((tone_length != TONE_LENGTH_SLOW) && (tone_length != TONE_LENGTH_FAST)) {
+		tone_length = TONE_LENGTH_FAST;
+		startup_freq = 1760;
+	}
+#else
 	/* If our startup mode is bogus, set something sensible
 	 * and make noise to let the user know something's wrong.
 	 */
@@ -406,6 +933,7 @@ int main(void)
 			sleep_ms(66);
 		}
 	}
+#endif
 
 /* Startup sequence for 13-key blueboxes. */
 #ifdef KEYS_13
@@ -427,13 +955,30 @@ int main(void)
 	case KEY_3:	tone_mode = MODE_REDBOX; break;
 	case KEY_4:	tone_mode = MODE_GREENBOX; break;
 	case KEY_5:	tone_mode = MODE_PULSE; break;
+	case KEY_0:	tone_mode = MODE_TRUNK; break;
 	case KEY_HASH:	if (tone_length == TONE_LENGTH_FAST)
 				tone_length = TONE_LENGTH_SLOW;
 			else
 				tone_length = TONE_LENGTH_FAST;
 			break;
+	case KEY_STAR:	/* Step down in volume, wrapping to loudest. */
+			if (volume + 1 >= VOLUME_LEVELS)
+				set_volume(0);
+			else
+				set_volume(volume + 1);
+			break;
+	/* Choose the timing profile for the startup tone mode. */
+	case KEY_6:	set_mode_profile(tone_mode, PROFILE_SPEC); break;
+	case KEY_7:	set_mode_profile(tone_mode, PROFILE_CONSERVATIVE); break;
+	case KEY_8:	set_mode_profile(tone_mode, PROFILE_CUSTOM); break;
+	case KEY_9:	set_mode_profile(tone_mode, PROFILE_STANDARD); break;
+#ifdef FAST_BOOT
+	default:	chirp(1000, startup_freq, startup_freq);
+			break;
+#else
 	default:	play(1000, 440, 440);	/* Normal startup tone. */
 			break;
+#endif
 	}
 
 	/*
@@ -441,19 +986,29 @@ int main(void)
 	 * then chirp high-low.  Otherwise, we're simply setting a mode and
 	 * not saving, so then just chirp high.
 	 */
-	if (startup_set) {
+	if (startup_set && !vcc_at_least(VCC_TO_BANDGAP(VCC_EEPROM_MIN_MV))) {
+		low_battery();
+	} else if (startup_set) {
 		play(75, 1700, 1700);
 		eeprom_update_byte((uint8_t *)EEPROM_STARTUP_TONE_MODE, tone_mode);
 		eeprom_update_byte((uint8_t *)EEPROM_STARTUP_TONE_LENGTH, tone_length);
+		eeprom_update_byte((uint8_t *)EEPROM_STARTUP_VOLUME, volume);
+		eeprom_update_byte((uint8_t *)EEPROM_PROFILE_MAP, profile_map);
 		eeprom_busy_wait();
 		play(1000, 1500, 1500);
 	} else {
+#ifdef FAST_BOOT
+		if (key > KEY_NOTHING) chirp(1000, 1700, 1700);
+#else
 		if (key > KEY_NOTHING) play(1000, 1700, 1700);
+#endif
 	}
 
 	while (key == getkey());	/* Wait for release. */
 #endif
 
+	load_timing(mode_profile(tone_mode));
+
 	/*
 	 * Main Loop
 	 *
@@ -467,15 +1022,28 @@ int main(void)
 	 */
 	while (TRUE) {
 		do {	/* Get the next keystroke. */
+			if (vcc_check_due)
+				check_vcc();
+			/*
+			 * Asked each time round, so the trunk's 2600 starts
+			 * as soon as a FAST_BOOT chirp lets go of timer 0.
+			 */
+			if (tone_mode == MODE_TRUNK)
+				trunk_tone();
 			key = getkey();
 		} while (key == KEY_NOTHING);
 
-		if (playback_mode)
+		if (playback_mode) {
+			code = key;
 			eeprom_playback(key);
-		else
-			process_key(key, FALSE);
+		} else if (key == KEY_SEIZE && seize_tap()) {
+			continue;	/* Nothing played, nothing to keep. */
+		} else {
+			code = shift_key(key);
+			process_key(code, FALSE);
+		}
 
-		process_longpress(key);
+		process_longpress(key, code);
 	}
 	return 0;
 } /* int main(void) */
@@ -493,6 +1061,14 @@ void eeprom_store(uint8_t key)
 	uint8_t ee_buffer[EEPROM_CHUNK_SIZE];
 	uint16_t i;
 
+	TRACE(TRACE_STORE, key);
+
+	/* Don't risk a half-written chunk on a flat battery. */
+	if (!vcc_at_least(VCC_TO_BANDGAP(VCC_EEPROM_MIN_MV))) {
+		low_battery();
+		return;
+	}
+
 	play(75, 1700, 1700);
 
 	ee_buffer[0] = tone_mode;
@@ -515,18 +1091,18 @@ void eeprom_store(uint8_t key)
 /*
  * void eeprom_playback(uint8_t key)
  *
- * Read the EEPROM memory chunk corresponding to the specified key.
- * Set the tone mode to the one specified by the first byte of the chunk.
- * Then play back the rest of the keys until we reach the end of the
- * chunk or hit 0xFF, which indicates the end of the sequence.
+ * Play the sequence in the EEPROM memory chunk corresponding to the
+ * specified key with play_chunk().  Everything is put back the way it
+ * was when we're done.
  *
  */
 void eeprom_playback(uint8_t key)
 {
-	uint8_t mem[EEPROM_CHUNK_SIZE];
 	uint16_t chunk;
-	uint8_t i;
 	uint8_t tone_mode_temp;
+	timing_t timing_temp;
+
+	TRACE(TRACE_PLAYBACK, key);
 
 	/* The 2600 key always plays 2600 in normal or playback modes. */
 #ifdef KEYS_13
@@ -544,23 +1120,126 @@ void eeprom_playback(uint8_t key)
 		return;
 	}
 
-	eeprom_read_block((uint8_t *)mem, (void *)chunk, EEPROM_CHUNK_SIZE);
+	tone_mode_temp = tone_mode;
+	timing_temp = timing;
+	play_chunk(chunk, 0, 0);
+
+	/* Don't leave a trunk running into another mode. */
+	if (tone_mode_temp != MODE_TRUNK) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			TIMER0_INT_OFF();
+			tones_on = FALSE;
+		}
+		OCR0A = SINE_MIDPOINT;
+	}
+	tone_mode = tone_mode_temp;
+	timing = timing_temp;
+
+	return;
+} /* void eeprom_playback(uint_t key) */
+
+
+/*
+ * void play_chunk(uint16_t chunk, uint8_t depth, uint16_t active)
+ *
+ * Set the tone mode to the one specified by the first byte of the chunk.
+ * Then play back the rest of the keys until we reach the end of the
+ * chunk or hit 0xFF, which indicates the end of the sequence.  The
+ * sequence is timed by its own profile if it names one, otherwise by
+ * the profile of whichever tone mode is playing.  Escape codes along the
+ * way may change the tone mode or tone length, pause, or play another
+ * chunk.  depth is how many calls deep this chunk is, and active has a
+ * bit set for each chunk playing further up, which is never played
+ * again.  The chunk is read a byte at a time, so calls cost little
+ * stack.
+ *
+ */
+void play_chunk(uint16_t chunk, uint8_t depth, uint16_t active)
+{
+	uint8_t code;
+	uint8_t i;
+	uint8_t profile;
+	uint8_t slot;
+	uint8_t tone_mode_temp;
+	timing_t timing_temp;
+
+	code = eeprom_read_byte((uint8_t *)chunk);
 
-	/* Abort if this chunk doesn't start with a valid mode. */
-	if (mem[0] < MODE_MIN || mem[0] > MODE_MAX)
+	/* Abort if this chunk doesn't start with a valid mode and profile. */
+	if ((code & SEQ_MODE_MASK) > MODE_MAX ||
+	    (code >> SEQ_PROFILE_SHIFT) > PROFILES)
 		return;
 
-	tone_mode_temp = tone_mode;
-	tone_mode = mem[0];
+	active |= 1 << ((chunk - EEPROM_MEM1) / EEPROM_CHUNK_SIZE);
+	tone_mode = code & SEQ_MODE_MASK;
+	profile = code >> SEQ_PROFILE_SHIFT;
+	load_timing(profile ? profile - 1 : mode_profile(tone_mode));
 
 	for (i = 1; i < EEPROM_CHUNK_SIZE; i++) {
-		if (mem[i] == 0xff) break;
-		process_key(mem[i], TRUE);
+		code = eeprom_read_byte((uint8_t *)chunk + i);
+		if (code == 0xff) break;
+		if (!(code & SEQ_ESCAPE)) {
+			process_key(code, TRUE);
+			continue;
+		}
+		if ((code & SEQ_CALL_OP_MASK) == SEQ_CALL) {
+			slot = code & SEQ_CALL_MASK;
+			if (slot >= SEQ_SLOTS || depth >= SEQ_CALL_DEPTH ||
+			    (active & (1 << slot)))
+				continue;
+			tone_mode_temp = tone_mode;
+			timing_temp = timing;
+			play_chunk(EEPROM_MEM1 + slot * EEPROM_CHUNK_SIZE,
+				   depth + 1, active);
+			tone_mode = tone_mode_temp;
+			timing = timing_temp;
+		} else if ((code & SEQ_PAUSE_OP_MASK) == SEQ_PAUSE) {
+			sleep_ms((code & SEQ_PAUSE_MASK) * SEQ_PAUSE_UNIT);
+		} else if ((code & SEQ_OP_MASK) == SEQ_MODE) {
+			if ((code & SEQ_ARG_MASK) <= MODE_MAX)
+				tone_mode = code & SEQ_ARG_MASK;
+			if (!profile)
+				load_timing(mode_profile(tone_mode));
+		} else {
+			if (code == SEQ_LENGTH) {
+				load_timing(profile ? profile - 1 : mode_profile(tone_mode));
+			} else {
+				timing.tone = (code & SEQ_ARG_MASK) * SEQ_LENGTH_UNIT;
+				timing.gap = timing.tone;
+			}
+		}
 	}
-	tone_mode = tone_mode_temp;
+	return;
+} /* void play_chunk(uint16_t chunk, uint8_t depth, uint16_t active) */
+
+
+/*
+ * void redial(void)
+ *
+ * Play the keystroke buffer back in the current tone mode, as if it
+ * had been stored and played back, but without touching EEPROM.  The
+ * buffer is left as it was so the same sequence can be redialed again.
+ *
+ */
+void redial(void)
+{
+	uint8_t keys[BUFFER_SIZE];
+	rbuf_count_t count;
+	uint8_t i;
+
+	count = rbuf_getcount(&rbuf);
+	if (count > BUFFER_SIZE)
+		count = BUFFER_SIZE;
 
+	for (i = 0; i < count; i++) {
+		keys[i] = rbuf_remove(&rbuf);
+		rbuf_insert(&rbuf, keys[i]);
+	}
+
+	for (i = 0; i < count; i++)
+		process_key(keys[i], TRUE);
 	return;
-} /* void eeprom_playback(uint_t key) */
+} /* void redial(void) */
 
 
 /*
@@ -598,66 +1277,70 @@ uint16_t key2chunk(uint8_t key)
  */
 void process_key(uint8_t key, bool pause)
 {
+	uint16_t gate;
+
 	if (key == 0) return;
+	TRACE(TRACE_KEY, key);
 
 #ifdef KEYS_13
 	/* The 2600 key always plays 2600, so catch it here. */
 	if (key == KEY_SEIZE) {
-		play(SEIZE_LENGTH, SEIZE, SEIZE);
-		if (pause) sleep_ms(SEIZE_PAUSE);
+		play(timing.seize, SEIZE, SEIZE);
+		if (pause) sleep_ms(timing.seize_pause);
 		return;
 	}
 #endif
 
 	if (tone_mode == MODE_MF) {
 		switch (key) {
-		case KEY_1:    play(tone_length, MF1, MF2); break;
-		case KEY_2:    play(tone_length, MF1, MF3); break;
-		case KEY_3:    play(tone_length, MF2, MF3); break;
-		case KEY_4:    play(tone_length, MF1, MF4); break;
-		case KEY_5:    play(tone_length, MF2, MF4); break;
-		case KEY_6:    play(tone_length, MF3, MF4); break;
-		case KEY_7:    play(tone_length, MF1, MF5); break;
-		case KEY_8:    play(tone_length, MF2, MF5); break;
-		case KEY_9:    play(tone_length, MF3, MF5); break;
-		case KEY_STAR: play(KP_LENGTH, MF3, MF6); break;   /* KP */
-		case KEY_0:    play(tone_length, MF4, MF5); break;
-		case KEY_HASH: play(tone_length, MF5, MF6); break; /* ST */
+		case KEY_1:    play(timing.tone, MF1, MF2); break;
+		case KEY_2:    play(timing.tone, MF1, MF3); break;
+		case KEY_3:    play(timing.tone, MF2, MF3); break;
+		case KEY_4:    play(timing.tone, MF1, MF4); break;
+		case KEY_5:    play(timing.tone, MF2, MF4); break;
+		case KEY_6:    play(timing.tone, MF3, MF4); break;
+		case KEY_7:    play(timing.tone, MF1, MF5); break;
+		case KEY_8:    play(timing.tone, MF2, MF5); break;
+		case KEY_9:    play(timing.tone, MF3, MF5); break;
+		case KEY_STAR: play(timing.kp, MF3, MF6); break;   /* KP */
+		case KEY_0:    play(timing.tone, MF4, MF5); break;
+		case KEY_HASH: play(timing.tone, MF5, MF6); break; /* ST */
+		/* 13-key pads reach these through shift_key(). */
+		case KEY_A:    play(timing.tone, MF2, MF6); break; /* Code 12 */
+		case KEY_B:    play(timing.tone, MF4, MF6); break; /* KP2 */
+		case KEY_C:    play(timing.tone, MF1, MF6); break; /* Code 11 */
 #ifdef KEYS_16
-		case KEY_A:    play(tone_length,  MF2, MF6); break; /* Code 12 */
-		case KEY_B:    play(tone_length, MF4, MF6); break; /* KP2 */
-		case KEY_C:    play(tone_length,  MF1, MF6); break; /* Code 11 */
-		case KEY_D:    play(SEIZE_LENGTH, SEIZE, SEIZE); break; /* Seize */
+		case KEY_D:    play(timing.seize, SEIZE, SEIZE); break; /* Seize */
 #endif
 		}
 #ifdef KEYS_16
 		if (key == KEY_D && pause)
-			sleep_ms(SEIZE_PAUSE);
+			sleep_ms(timing.seize_pause);
 		else
 #endif
-			if (pause) sleep_ms(tone_length);
+			if (pause) sleep_ms(timing.gap);
 	} else if (tone_mode == MODE_DTMF) {
 		switch (key) {
-		case KEY_1:    play(tone_length, DTMF_ROW1, DTMF_COL1); break;
-		case KEY_2:    play(tone_length, DTMF_ROW1, DTMF_COL2); break;
-		case KEY_3:    play(tone_length, DTMF_ROW1, DTMF_COL3); break;
-		case KEY_4:    play(tone_length, DTMF_ROW2, DTMF_COL1); break;
-		case KEY_5:    play(tone_length, DTMF_ROW2, DTMF_COL2); break;
-		case KEY_6:    play(tone_length, DTMF_ROW2, DTMF_COL3); break;
-		case KEY_7:    play(tone_length, DTMF_ROW3, DTMF_COL1); break;
-		case KEY_8:    play(tone_length, DTMF_ROW3, DTMF_COL2); break;
-		case KEY_9:    play(tone_length, DTMF_ROW3, DTMF_COL3); break;
-		case KEY_STAR: play(tone_length, DTMF_ROW4, DTMF_COL1); break;
-		case KEY_0:    play(tone_length, DTMF_ROW4, DTMF_COL2); break;
-		case KEY_HASH: play(tone_length, DTMF_ROW4, DTMF_COL3); break;
+		case KEY_1:    play(timing.tone, DTMF_ROW1, DTMF_COL1); break;
+		case KEY_2:    play(timing.tone, DTMF_ROW1, DTMF_COL2); break;
+		case KEY_3:    play(timing.tone, DTMF_ROW1, DTMF_COL3); break;
+		case KEY_4:    play(timing.tone, DTMF_ROW2, DTMF_COL1); break;
+		case KEY_5:    play(timing.tone, DTMF_ROW2, DTMF_COL2); break;
+		case KEY_6:    play(timing.tone, DTMF_ROW2, DTMF_COL3); break;
+		case KEY_7:    play(timing.tone, DTMF_ROW3, DTMF_COL1); break;
+		case KEY_8:    play(timing.tone, DTMF_ROW3, DTMF_COL2); break;
+		case KEY_9:    play(timing.tone, DTMF_ROW3, DTMF_COL3); break;
+		case KEY_STAR: play(timing.tone, DTMF_ROW4, DTMF_COL1); break;
+		case KEY_0:    play(timing.tone, DTMF_ROW4, DTMF_COL2); break;
+		case KEY_HASH: play(timing.tone, DTMF_ROW4, DTMF_COL3); break;
 #ifdef KEYS_16
-		case KEY_A:    play(tone_length, DTMF_ROW1, DTMF_COL4); break;
-		case KEY_B:    play(tone_length, DTMF_ROW2, DTMF_COL4); break;
-		case KEY_C:    play(tone_length, DTMF_ROW3, DTMF_COL4); break;
-		case KEY_D:    play(tone_length, DTMF_ROW4, DTMF_COL4); break;
+		case KEY_A:    play(timing.tone, DTMF_ROW1, DTMF_COL4); break;
+		case KEY_B:    play(timing.tone, DTMF_ROW2, DTMF_COL4); break;
+		case KEY_C:    play(timing.tone, DTMF_ROW3, DTMF_COL4); break;
+		case KEY_D:    play(timing.tone, DTMF_ROW4, DTMF_COL4); break;
 #endif
 		}
-		if (pause) sleep_ms(tone_length);
+		if (pause) sleep_ms(timing.gap);
 	} else if (tone_mode == MODE_REDBOX) {
 		switch (key) {
 		case KEY_1: play(66, RB1, RB2);	/* US Nickel */
@@ -699,7 +1382,7 @@ void process_key(uint8_t key, bool pause)
 		case KEY_8: play(350, UKRB, UKRB);  	/* UK 50 pence */
 			break;
 		}
-		if (pause) sleep_ms(REDBOX_PAUSE);
+		if (pause) sleep_ms(timing.pause);
 	} else if (tone_mode == MODE_GREENBOX) {
 		switch(key) {
 		/* Using 2600 wink */
@@ -753,7 +1436,7 @@ void process_key(uint8_t key, bool pause)
 			play(700, MF5, MF6);
 			break;
 		}
-		if (pause) sleep_ms(GREENBOX_PAUSE);
+		if (pause) sleep_ms(timing.pause);
 	} else if (tone_mode == MODE_PULSE) {
 		switch (key) {
 		case KEY_1: pulse(1); break;
@@ -767,7 +1450,17 @@ void process_key(uint8_t key, bool pause)
 		case KEY_9: pulse(9); break;
 		case KEY_0: pulse(10); break;
 		}
-		if (pause) sleep_ms(PULSE_PAUSE);
+		if (pause) sleep_ms(timing.pause);
+	} else if (tone_mode == MODE_TRUNK) {
+		trunk(key);
+		if (pause) {
+			do {	/* Let a wink finish. */
+				ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+					gate = gate_samples;
+				}
+			} while (gate);
+			sleep_ms(timing.pause);
+		}
 	}
 	return;
 } /* void process_key(uint8_t key, bool pause) */
@@ -797,6 +1490,9 @@ void process_key(uint8_t key, bool pause)
 uint8_t getkey(void)
 {
 	uint8_t voltage;
+#ifdef SCENARIO
+	return scenario_key();
+#endif
 	while (1) {
 		ADCSRA |= (1 << ADSC);		/* start ADC measurement */
 		while (ADCSRA & (1 << ADSC) );	/* wait till conversion complete */
@@ -805,47 +1501,203 @@ uint8_t getkey(void)
 		ADCSRA |= (1 << ADSC);		/* start ADC measurement */
 		while (ADCSRA & (1 << ADSC) );	/* wait till conversion complete */
 		if (voltage != ADCH) continue;	/* bouncy result, try again */
-		if (voltage <  13) return 0;	/* no key has been pressed */
-
-		/* If we made it this far, then we've got something valid */
-		/* These values calculated with Vdd = 5 volts DC */
-
-		/* 4.64 volts.  ADC value = 246 */
-		if (voltage > 233 ) return KEY_SEIZE;
-		/* 4.29 volts.  ADC value = 219 */
-		if (voltage > 211 && voltage <= 232) return KEY_1;
-		/* 3.93 volts.  ADC value = 201 */
-		if (voltage > 192 && voltage <= 210) return KEY_2;
-		/* 3.57 volts.  ADC value = 183 */
-		if (voltage > 174 && voltage <= 191) return KEY_3;
-		/* 3.21 volts.  ADC value = 165 */
-		if (voltage > 155 && voltage <= 173) return KEY_4;
-		/* 2.86 volts.  ADC value = 146 */
-		if (voltage > 137 && voltage <= 154) return KEY_5;
-		/* 2.50 volts.  ADC value = 128 */
-		if (voltage > 119 && voltage <= 136) return KEY_6;
-		/* 2.14 volts.  ADC value = 110 */
-		if (voltage > 101 && voltage <= 118) return KEY_7;
-		/* 1.79 volts.  ADC value = 91 */
-		if (voltage > 82  && voltage <= 100) return KEY_8;
-		/* 1.42 volts.  ADC value = 73 */
-		if (voltage > 64  && voltage <=  81) return KEY_9;
-		/* 1.07 volts.  ADC value = 55 */
-		if (voltage > 46  && voltage <=  63) return KEY_STAR;
-		/* 0.71 volts.  ADC value = 37 */
-		if (voltage > 27  && voltage <=  45) return KEY_0;
-		/* 0.357 volts.  ADC value = 18 */
-		if (voltage > 16   && voltage <=  26) return KEY_HASH;
-		/* We shouldn't get past here, */
-		/* but if we do, treat it like no key detected. */
-		break;
+		return ladder_key(voltage);
 	}
-	return KEY_NOTHING;
 }  /* uint8_t getkey(void) */
 
 
 /*
- * void process_longpress(uint8_t key)
+ * uint8_t ladder_key(uint8_t voltage)
+ *
+ * Turn a steady ADC reading from the ladder into a key, or 0 if no key
+ * is pressed.
+ *
+ */
+uint8_t ladder_key(uint8_t voltage)
+{
+	if (voltage <  13) return 0;	/* no key has been pressed */
+
+	/* If we made it this far, then we've got something valid */
+	/* These values calculated with Vdd = 5 volts DC */
+	/* but the ladder is ratiometric, so they hold at any Vdd. */
+
+	/* 4.64 volts.  ADC value = 246 */
+	if (voltage > 233 ) return KEY_SEIZE;
+	/* 4.29 volts.  ADC value = 219 */
+	if (voltage > 211 && voltage <= 232) return KEY_1;
+	/* 3.93 volts.  ADC value = 201 */
+	if (voltage > 192 && voltage <= 210) return KEY_2;
+	/* 3.57 volts.  ADC value = 183 */
+	if (voltage > 174 && voltage <= 191) return KEY_3;
+	/* 3.21 volts.  ADC value = 165 */
+	if (voltage > 155 && voltage <= 173) return KEY_4;
+	/* 2.86 volts.  ADC value = 146 */
+	if (voltage > 137 && voltage <= 154) return KEY_5;
+	/* 2.50 volts.  ADC value = 128 */
+	if (voltage > 119 && voltage <= 136) return KEY_6;
+	/* 2.14 volts.  ADC value = 110 */
+	if (voltage > 101 && voltage <= 118) return KEY_7;
+	/* 1.79 volts.  ADC value = 91 */
+	if (voltage > 82  && voltage <= 100) return KEY_8;
+	/* 1.42 volts.  ADC value = 73 */
+	if (voltage > 64  && voltage <=  81) return KEY_9;
+	/* 1.07 volts.  ADC value = 55 */
+	if (voltage > 46  && voltage <=  63) return KEY_STAR;
+	/* 0.71 volts.  ADC value = 37 */
+	if (voltage > 27  && voltage <=  45) return KEY_0;
+	/* 0.357 volts.  ADC value = 18 */
+	if (voltage > 16   && voltage <=  26) return KEY_HASH;
+	/* We shouldn't get past here, */
+	/* but if we do, treat it like no key detected. */
+	return KEY_NOTHING;
+}  /* uint8_t ladder_key(uint8_t voltage) */
+
+
+#ifdef SCENARIO
+/*
+ * uint8_t scenario_key(void)
+ *
+ * Stands in for getkey() when the SCENARIO build option holds a script
+ * of key presses, so that a simulator run can dial something without a
+ * keypad.  Digits, and K or * and T or # for star and hash, are pressed
+ * for SCENARIO_PRESS ms.  S presses 2600 for SCENARIO_SEIZE ms, and ^
+ * taps it for SCENARIO_PRESS ms, which shifts the next key in MF mode
+ * or, as ^^, redials (see seize_tap()).  A + after a key holds it for
+ * SCENARIO_HOLD ms
+ * instead, long enough for a long press.  Every press
+ * is followed by SCENARIO_GAP ms with no key, and a . is just a gap.
+ * Once the script runs out no key is ever pressed again.
+ *
+ */
+uint8_t scenario_key(void)
+{
+	static const char script[] PROGMEM = SCENARIO;
+	static uint8_t place;
+	static uint16_t calls;
+	uint16_t press;
+	uint8_t key;
+	char c;
+
+	c = pgm_read_byte(&script[place]);
+	switch (c) {
+	case '\0':
+		sleep_ms(DEBOUNCE_TIME);
+		return KEY_NOTHING;
+	case '1': key = KEY_1; break;
+	case '2': key = KEY_2; break;
+	case '3': key = KEY_3; break;
+	case '4': key = KEY_4; break;
+	case '5': key = KEY_5; break;
+	case '6': key = KEY_6; break;
+	case '7': key = KEY_7; break;
+	case '8': key = KEY_8; break;
+	case '9': key = KEY_9; break;
+	case '0': key = KEY_0; break;
+	case 'K':
+	case '*': key = KEY_STAR; break;
+	case 'T':
+	case '#': key = KEY_HASH; break;
+	case 'S':
+	case '^': key = KEY_SEIZE; break;
+	default:  key = KEY_NOTHING; break;
+	}
+
+	if (key == KEY_NOTHING)
+		press = 0;
+	else if (pgm_read_byte(&script[place + 1]) == '+')
+		press = SCENARIO_HOLD / DEBOUNCE_TIME;
+	else if (c == 'S')
+		press = SCENARIO_SEIZE / DEBOUNCE_TIME;
+	else
+		press = SCENARIO_PRESS / DEBOUNCE_TIME;
+
+	if (calls == 0 && press)
+		SCENARIO_MARK(key);
+	else if (calls == press)
+		SCENARIO_MARK(0);
+
+	sleep_ms(DEBOUNCE_TIME);	/* Take as long as getkey() does. */
+
+	if (calls < press) {
+		calls++;
+		return key;
+	}
+	if (++calls >= press + SCENARIO_GAP / DEBOUNCE_TIME) {
+		calls = 0;
+		place += (press == SCENARIO_HOLD / DEBOUNCE_TIME) ? 2 : 1;
+	}
+	return KEY_NOTHING;
+} /* uint8_t scenario_key(void) */
+#endif
+
+
+/*
+ * bool seize_tap(void)
+ *
+ * 13-key version
+ *
+ * Called when 2600 is pressed.  A tap of 2600, let go within
+ * SHIFT_TAP_TIME ms, sends nothing at all.  There are no keys for the
+ * extended MF codes, so in MF mode a tap shifts the next key pressed
+ * within SHIFT_TIME ms instead (see shift_key()).  A second tap within
+ * that time, in any mode, redials the keystroke buffer (see redial()).
+ * Returns TRUE for a tap.  A longer press is 2600 as usual,
+ * SHIFT_TAP_TIME ms late, so a tap can't clear down a trunk partway
+ * through KP to ST.
+ *
+ */
+bool seize_tap(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < SHIFT_TAP_TIME / DEBOUNCE_TIME; i++) {
+		if (getkey() != KEY_SEIZE) {
+			if (shift_on) {
+				shift_on = FALSE;
+				redial();
+			} else {
+				ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+					shift_counter = SHIFT_TIME;
+					shift_on = TRUE;
+				}
+			}
+			return TRUE;
+		}
+	}
+	return FALSE;
+} /* bool seize_tap(void) */
+
+
+/*
+ * uint8_t shift_key(uint8_t key)
+ *
+ * 13-key version
+ *
+ * After a seize_tap(), the next key pressed within SHIFT_TIME ms is
+ * shifted: 1 plays Code 11, 2 Code 12 and 3 KP2.  Any other key plays
+ * as usual, KP included.  The shift is only ever looked at, never
+ * waited for, so no key is held up.  Returns the key to play.
+ *
+ */
+uint8_t shift_key(uint8_t key)
+{
+	if (!shift_on)
+		return key;
+	shift_on = FALSE;
+
+	if (tone_mode != MODE_MF)
+		return key;
+	switch (key) {
+	case KEY_1:	return KEY_C;	/* Code 11 */
+	case KEY_2:	return KEY_A;	/* Code 12 */
+	case KEY_3:	return KEY_B;	/* KP2 */
+	default:	return key;
+	}
+} /* uint8_t shift_key(uint8_t key) */
+
+
+/*
+ * void process_longpress(uint8_t key, uint8_t code)
  *
  * 13-key version
  *
@@ -856,8 +1708,11 @@ uint8_t getkey(void)
  * The only long press while in memory playback mode that is honored is
  * 2600, which will toggle the bluebox back to normal mode.
  *
+ * Otherwise code, which is what the key played after shift_key(), goes
+ * in the keystroke buffer.
+ *
  */
-void process_longpress(uint8_t key)
+void process_longpress(uint8_t key, uint8_t code)
 {
 	bool just_flipped = FALSE;
 	bool just_wrote = FALSE;
@@ -895,16 +1750,83 @@ void process_longpress(uint8_t key)
 	/* If a long press was not detected, */
 	/* store the key in the circular buffer.*/
 	if (!playback_mode && !just_flipped && !just_wrote)
-		rbuf_insert(&rbuf, key);
+		rbuf_insert(&rbuf, code);
 	just_flipped = FALSE;
 	just_wrote = FALSE;
 	return;
-} /* void process_longpress(uint8_t key) */
+} /* void process_longpress(uint8_t key, uint8_t code) */
 #else	/* We're using a 16-key keypad */
 #error 16-keys not yet implemented
 #endif
 
 
+#ifdef MICROBENCH
+/*
+ * void microbench(void)
+ *
+ * Run each kernel MICROBENCH_REPS times with its number in GPIOR2.
+ * The results go to a volatile so none of the calls are optimized
+ * away.  The timer interrupt is called directly, with a dual tone set
+ * up, so its prologue and epilogue count too.
+ *
+ */
+void microbench(void)
+{
+	static rbuf_t bench;
+	static volatile uint16_t sink;
+	uint16_t i;
+
+	TIMSK &= ~(1 << OCIE1A);
+	rbuf_init(&bench);
+
+	GPIOR2 = MICROBENCH_LOOP;
+	for (i = 0; i < MICROBENCH_REPS; i++)
+		sink = i;
+	GPIOR2 = 0;
+
+	set_tones(MF1, MF2);
+	tones_on = TRUE;
+	GPIOR2 = MICROBENCH_ISR;
+	for (i = 0; i < MICROBENCH_REPS; i++)
+		TIM0_OVF_vect();
+	GPIOR2 = 0;
+	tones_on = FALSE;
+	OCR0A = SINE_MIDPOINT;
+
+	GPIOR2 = MICROBENCH_SET_TONES;
+	for (i = 0; i < MICROBENCH_REPS; i++)
+		set_tones(MF1 + i, MF2);
+	GPIOR2 = 0;
+
+	GPIOR2 = MICROBENCH_LADDER;
+	for (i = 0; i < MICROBENCH_REPS; i++)
+		sink = ladder_key(i);
+	GPIOR2 = 0;
+
+	GPIOR2 = MICROBENCH_RBUF;
+	for (i = 0; i < MICROBENCH_REPS; i++) {
+		rbuf_insert(&bench, i);
+		sink = rbuf_remove(&bench);
+	}
+	GPIOR2 = 0;
+
+	GPIOR2 = MICROBENCH_KEY2CHUNK;
+	for (i = 0; i < MICROBENCH_REPS; i++)
+		sink = key2chunk(i & 0x0F);
+	GPIOR2 = 0;
+
+	GPIOR2 = MICROBENCH_LOAD_TIMING;
+	for (i = 0; i < MICROBENCH_REPS; i++)
+		load_timing(i & PROFILE_MASK);
+	GPIOR2 = 0;
+
+	(void) sink;
+	TIMSK |= (1 << OCIE1A);
+	return;
+} /* void microbench(void) */
+#endif
+
+
 /*
  * PB0 is audio output.
  * PB1 is LED output.  Pull down to light LEDs.
@@ -916,13 +1838,105 @@ void init_ports(void)
 {
 	cli();
 	DDRB  = 0b11100011;
-	TIMSK |= (1<<TOIE0);
+#if DEBUG_LEVEL > 0
+	PORTB |= (1 << PB1);	/* Serial line idles high. */
+#else
 	PORTB &= ~(1 << PB1);	/* Make sure LEDs are off. */
+#endif
 	sei();
 	return;
 }
 
 
+/*
+ * void init_timer1(void)
+ *
+ * Start timer 1 as the millisecond clock.  See TIMER1_PER_MILLISEC.
+ *
+ */
+void init_timer1(void)
+{
+	OCR1C = TIMER1_PER_MILLISEC - 1;
+	OCR1A = 0;
+	TCCR1 = (1 << CTC1) | TIMER1_PRESCALE_128;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		TIMSK |= (1 << OCIE1A);
+	}
+	return;
+} /* void init_timer1(void) */
+
+
+/*
+ * uint16_t read_bandgap(void)
+ *
+ * Measure the internal bandgap reference against Vcc and return the
+ * 10-bit result.  The ADC is switched back to the keypad afterwards.
+ * The first conversion after switching to the bandgap isn't reliable,
+ * so it's thrown away.
+ *
+ */
+uint16_t read_bandgap(void)
+{
+	uint16_t result;
+
+	ADMUX = ADMUX_BANDGAP;
+	sleep_ms(1);			/* let the bandgap settle */
+	ADCSRA |= (1 << ADSC);		/* start ADC measurement */
+	while (ADCSRA & (1 << ADSC) );	/* wait till conversion complete */
+	ADCSRA |= (1 << ADSC);		/* and again for real */
+	while (ADCSRA & (1 << ADSC) );
+	result = ADC >> 6;		/* left adjusted */
+	ADMUX = ADMUX_LADDER;
+
+	TRACE(TRACE_VCC, result);
+	return result;
+} /* uint16_t read_bandgap(void) */
+
+
+/*
+ * bool vcc_at_least(uint16_t bandgap)
+ *
+ * Is Vcc at least the voltage whose bandgap reading is given?  Use
+ * VCC_TO_BANDGAP() to get that reading from millivolts.
+ *
+ */
+bool vcc_at_least(uint16_t bandgap)
+{
+	return read_bandgap() <= bandgap;
+}
+
+
+/*
+ * void check_vcc(void)
+ *
+ * Called from the main loop while waiting for a key every
+ * VCC_CHECK_INTERVAL milliseconds.  Complain if the battery is low.
+ *
+ */
+void check_vcc(void)
+{
+	vcc_check_due = FALSE;
+	if (!vcc_at_least(VCC_TO_BANDGAP(VCC_LOW_MV)))
+		low_battery();
+	return;
+}
+
+
+/*
+ * void low_battery(void)
+ *
+ * Two low beeps, for a low battery or a refused EEPROM write.
+ *
+ */
+void low_battery(void)
+{
+	play(75, 440, 440);
+	sleep_ms(66);
+	play(75, 440, 440);
+	return;
+}
+
+
 /*
  * void init_adc(void)
  *
@@ -980,6 +1994,47 @@ void init_adc(void)
  *
  */
 void play(uint32_t duration, uint32_t freq_a, uint32_t freq_b)
+{
+#if DEBUG_LEVEL > 0
+	struct { uint16_t duration, freq_a, freq_b; } event =
+		{ duration, freq_a, freq_b };
+	TRACE(TRACE_PLAY, event);
+#endif
+#ifdef FAST_BOOT
+	/* Take over from any chirp still playing. */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		chirp_counter = 0;
+	}
+#endif
+	set_tones(freq_a, freq_b);
+
+	LED_ON();
+	tones_on = TRUE;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		gate_samples = 0;	/* Forget any trunk wink. */
+		TIMER0_INT_ON();
+	}
+	sleep_ms(duration);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		TIMER0_INT_OFF();
+	}
+	tones_on = FALSE;
+	OCR0A = SINE_MIDPOINT;	/* Send 0V to PWM output */
+	LED_OFF();
+
+	return;
+}
+
+
+/*
+ * void set_tones(uint32_t freq_a, uint32_t freq_b)
+ *
+ * Convert a pair of frequencies (in Hz) to sine table steps for the
+ * timer interrupt and start both tones at the beginning of the table.
+ * A freq_b of zero or the same as freq_a means a single tone.
+ *
+ */
+void set_tones(uint32_t freq_a, uint32_t freq_b)
 {
 	uint32_t tmp_a = SAMPLES_PER_HERTZ_TIMES_256;
 	uint32_t tmp_b = SAMPLES_PER_HERTZ_TIMES_256;
@@ -995,23 +2050,190 @@ void play(uint32_t duration, uint32_t freq_a, uint32_t freq_b)
 	tone_a_place = 0;
 	tone_b_place = 0;
 
-	PORTB |= (1 << PB1);	/* Turn on LEDs. */
+	/* Let the timer interrupt skip the second tone if it's a copy. */
+	single_tone = (tone_a_step == tone_b_step);
+
+	return;
+}
+
+
+/*
+ * void set_volume(uint8_t level)
+ *
+ * Set the output level, from 0 (loudest) to VOLUME_LEVELS - 1 in 4 dB
+ * steps.
+ *
+ */
+void set_volume(uint8_t level)
+{
+	volume = level;
+#ifndef SIGMA_DELTA
+	sine_level = sine_table[level];
+#endif
+	return;
+}
+
+
+/*
+ * void load_timing(uint8_t profile)
+ *
+ * Make the given profile the current one, filling in the custom
+ * overrides and the fast/slow tone length where the profile defers.
+ *
+ */
+void load_timing(uint8_t profile)
+{
+	uint8_t custom;
+
+	memcpy_P(&timing, &timing_profiles[profile & PROFILE_MASK], sizeof(timing_t));
+
+	if (profile == PROFILE_CUSTOM) {
+		custom = eeprom_read_byte((uint8_t *)EEPROM_CUSTOM_TONE);
+		if (custom != 0xFF)
+			timing.tone = custom * SEQ_LENGTH_UNIT;
+		custom = eeprom_read_byte((uint8_t *)EEPROM_CUSTOM_GAP);
+		if (custom != 0xFF)
+			timing.gap = custom * SEQ_LENGTH_UNIT;
+		custom = eeprom_read_byte((uint8_t *)EEPROM_CUSTOM_SEIZE_PAUSE);
+		if (custom != 0xFF)
+			timing.seize_pause = custom * CUSTOM_SEIZE_PAUSE_UNIT;
+	}
+
+	if (timing.tone == 0)
+		timing.tone = tone_length;
+	if (timing.gap == 0)
+		timing.gap = timing.tone;
+	return;
+} /* void load_timing(uint8_t profile) */
+
+
+/*
+ * uint8_t mode_profile(uint8_t mode)
+ * void set_mode_profile(uint8_t mode, uint8_t profile)
+ *
+ * Get or set the timing profile of a tone mode in the profile map.
+ * Redbox, greenbox and trunk share one.
+ *
+ */
+static uint8_t profile_shift(uint8_t mode)
+{
+	switch (mode) {
+	case MODE_MF:	 return 0;
+	case MODE_DTMF:	 return 2;
+	case MODE_PULSE: return 4;
+	default:	 return 6;
+	}
+}
+
+uint8_t mode_profile(uint8_t mode)
+{
+	return (profile_map >> profile_shift(mode)) & PROFILE_MASK;
+}
+
+void set_mode_profile(uint8_t mode, uint8_t profile)
+{
+	profile_map &= ~(PROFILE_MASK << profile_shift(mode));
+	profile_map |= (profile & PROFILE_MASK) << profile_shift(mode);
+	return;
+}
+
+
+#ifdef FAST_BOOT
+/*
+ * void chirp(uint16_t duration, uint32_t freq_a, uint32_t freq_b)
+ *
+ * Like play(), but returns right away.  The timer interrupt shuts the
+ * tones off when the duration runs out.  This is used for startup
+ * tones so that the keypad can be read while they play.
+ *
+ */
+void chirp(uint16_t duration, uint32_t freq_a, uint32_t freq_b)
+{
+	set_tones(freq_a, freq_b);
+
+	LED_ON();
 	tones_on = TRUE;
-	sleep_ms(duration);
-	tones_on = FALSE;
-	PORTB &= ~(1 << PB1);	/* Turn off LEDs. */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		chirp_counter = duration;
+		TIMER0_INT_ON();
+	}
 
 	return;
 }
+#endif
+
+
+/*
+ * void trunk(uint8_t key)
+ *
+ * Trunk mode commands.  1 seizes (tone off), 2 idles (tone on),
+ * 3 winks from idle and 4 sends a timed disconnect.  A wink drops the
+ * tone and has the timer interrupt bring it back TRUNK_WINK ms later.
+ * A disconnect sends 2600 for TRUNK_DISCONNECT ms and leaves the trunk
+ * idle, tone on.  Either way the trunk settles idle once the interrupt
+ * counts the time out.
+ *
+ */
+void trunk(uint8_t key)
+{
+	uint16_t samples = 0;
+	bool tone;
+
+	switch (key) {
+	case KEY_1: trunk_seized = TRUE; tone = FALSE; break;
+	case KEY_2: trunk_seized = FALSE; tone = TRUE; break;
+	case KEY_3: trunk_seized = FALSE; tone = FALSE;
+		samples = MS_TO_SAMPLES(TRUNK_WINK);
+		break;
+	case KEY_4: trunk_seized = FALSE; tone = TRUE;
+		samples = MS_TO_SAMPLES(TRUNK_DISCONNECT);
+		break;
+	default: return;
+	}
+
+	trunk_tone();
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		tones_on = tone;
+		gate_samples = samples;
+	}
+	return;
+} /* void trunk(uint8_t key) */
+
+
+/*
+ * void trunk_tone(void)
+ *
+ * Start the trunk's 2600 running in the background if something else,
+ * like play(), has stopped it.  When seized it runs silently so that
+ * the phase carries on.  While a chirp() still has the timer 0
+ * interrupt this does nothing, and the main loop tries again.
+ *
+ */
+void trunk_tone(void)
+{
+	if (TIMSK & (1 << TOIE0))
+		return;
+
+	set_tones(SEIZE, SEIZE);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		tones_on = !trunk_seized;
+		gate_samples = 0;
+		TIMER0_INT_ON();
+	}
+	return;
+} /* void trunk_tone(void) */
 
 
 /*
  * void pulse(uint8_t count)
  *
- * Send a series of 2600hz pulses with the same timing as a rotary dialer
+ * Send a series of 2600hz pulses with the same timing as a rotary dialer,
+ * or whatever the current timing profile says.
  * This pre-dates the US R1/MF signalling system.
  * This was how John Draper (aka Cap'n Crunch) and Joe Engressia Jr.
  * (aka Joybubbles) were able to phreak using a whistled 2600hz tone.
+ * On an SF trunk 2600 means on-hook, so the tone is each pulse's break
+ * and the gap is the make.
  *
  */
 void pulse(uint8_t count)
@@ -1019,8 +2241,8 @@ void pulse(uint8_t count)
 	uint8_t	i;
 
 	for (i = 0; i < count; i++) {
-		play(66, SEIZE, SEIZE);
-		sleep_ms(34);
+		play(timing.pulse_tone, SEIZE, SEIZE);
+		sleep_ms(timing.pulse_gap);
 	}
 	return;
 }
@@ -1045,15 +2267,76 @@ void sleep_ms(uint16_t milliseconds)
 {
 	while( milliseconds > 0 ) {
 		if( millisec_flag ) {
+#if DEBUG_LEVEL > 0
+			/* Timer 1 has counted since it raised the flag. */
+			if (TCNT1 > latency_max)
+				latency_max = TCNT1;
+#endif
 			millisec_flag = FALSE;
 			milliseconds--;
 			tick();
 		}
+#if DEBUG_LEVEL > 0
+		else
+			idle_spins++;
+#endif
 	}
 	return;
 }
 
-void tick(void) {}
+/*
+ * void tick(void)
+ *
+ * Called once a millisecond from sleep_ms().  Schedule the next supply
+ * voltage check.  In debug builds, send the interrupt and stack
+ * statistics and the load meter every TRACE_STATS_INTERVAL.
+ *
+ * The load meter counts how often sleep_ms() goes round its loop with
+ * nothing to do and compares that to an idle millisecond measured at
+ * powerup.  Whatever is missing went to interrupts and the main loop.
+ *
+ */
+void tick(void)
+{
+	static uint16_t vcc_counter;
+#if DEBUG_LEVEL > 0
+	static uint16_t counter;
+	struct { uint8_t isr_cycles; uint16_t stack; } __attribute__ ((packed))
+		stats;
+	struct { uint8_t mode, busy, latency; } load;
+	uint32_t idle_expected;
+
+	idle_total += idle_spins;
+	idle_spins = 0;
+#endif
+
+	if (++vcc_counter >= VCC_CHECK_INTERVAL) {
+		vcc_counter = 0;
+		vcc_check_due = TRUE;
+	}
+
+#if DEBUG_LEVEL > 0
+	if (++counter < TRACE_STATS_INTERVAL)
+		return;
+	counter = 0;
+	stats.isr_cycles = isr_cycles_max;
+	isr_cycles_max = 0;
+	stats.stack = stack_unused();
+	TRACE(TRACE_STATS, stats);
+
+	idle_expected = (uint32_t)idle_full * TRACE_STATS_INTERVAL;
+	load.mode = tone_mode;
+	if (idle_total >= idle_expected)
+		load.busy = 0;
+	else
+		load.busy = 100 - idle_total * 100 / idle_expected;
+	load.latency = latency_max;
+	latency_max = 0;
+	idle_total = 0;
+	TRACE(TRACE_LOAD, load);
+#endif
+	return;
+}
 
 
 /*
@@ -1064,7 +2347,8 @@ void tick(void) {}
  * approximation of a sine wave.  This is smoothed out with a low-pass
  * filter after the signal exits the microcontroller.
  *
- * This timer also provides the timing for the sleep_ms() function.
+ * This interrupt is only enabled while a tone is playing.  Timing is
+ * done by timer 1 so that nothing here affects it.
  *
  * Further reading:
  *    https://en.wikipedia.org/wiki/Pulse-width_modulation
@@ -1073,42 +2357,283 @@ void tick(void) {}
  */
 ISR(TIM0_OVF_vect)
 {
-	if (tones_on) {
-	OCR0A = (pgm_read_byte(&(sine_table[(tone_a_place >> STEP_SHIFT)])) +
-		pgm_read_byte(&(sine_table[(tone_b_place >> STEP_SHIFT)]))) / 2;
+#ifdef DITHER
+	static uint8_t dither_error;
+	uint16_t sample;
+#endif
+
+	if (tones_on && single_tone) {
+	/*
+	 * Half the work for a single tone.  Averaging a sample with
+	 * itself changes nothing, so this sounds exactly the same as
+	 * playing it as two tones.
+	 */
+	CYCLE_BENCH_MARK(CYCLE_BENCH_ONE_TONE);
+#ifdef SIGMA_DELTA
+	OCR0A = sigma_delta(pgm_read_word(&(sine_table16[(tone_a_place >> STEP_SHIFT)])));
+#else
+	OCR0A = pgm_read_byte(&(sine_level[(tone_a_place >> STEP_SHIFT)]));
+#endif
+	tone_a_place += tone_a_step;
+	if(tone_a_place >= (SINE_SAMPLES << STEP_SHIFT))
+		tone_a_place -= (SINE_SAMPLES << STEP_SHIFT);
+	if (gate_samples && --gate_samples == 0)
+		tones_on = !trunk_seized;
+	} else if (tones_on) {
+	CYCLE_BENCH_MARK(CYCLE_BENCH_TWO_TONES);
+#if defined(SIGMA_DELTA)
+	OCR0A = sigma_delta(((int16_t)pgm_read_word(&(sine_table16[(tone_a_place >> STEP_SHIFT)])) +
+		(int16_t)pgm_read_word(&(sine_table16[(tone_b_place >> STEP_SHIFT)]))) >> 1);
+#elif defined(DITHER)
+	/*
+	 * First-order noise shaping.  The bit dropped when the two tones
+	 * are averaged is fed into the next sample instead of being
+	 * thrown away.  This pushes the error up towards the PWM
+	 * frequency, where the output filter gets rid of it.
+	 */
+	sample = pgm_read_byte(&(sine_level[(tone_a_place >> STEP_SHIFT)])) +
+		pgm_read_byte(&(sine_level[(tone_b_place >> STEP_SHIFT)])) +
+		dither_error;
+	OCR0A = sample >> 1;
+	dither_error = sample & 1;
+#else
+	OCR0A = (pgm_read_byte(&(sine_level[(tone_a_place >> STEP_SHIFT)])) +
+		pgm_read_byte(&(sine_level[(tone_b_place >> STEP_SHIFT)]))) / 2;
+#endif
 	tone_a_place += tone_a_step;
 	tone_b_place += tone_b_step;
 	if(tone_a_place >= (SINE_SAMPLES << STEP_SHIFT))
 		tone_a_place -= (SINE_SAMPLES << STEP_SHIFT);
 	if(tone_b_place >= (SINE_SAMPLES << STEP_SHIFT))
 		tone_b_place -= (SINE_SAMPLES << STEP_SHIFT);
-	} else OCR0A = SINE_MIDPOINT; /* Send 0V to PWM output */
-
-	/* Count milliseconds */
-	millisec_counter--;
-	if(millisec_counter == 0) {
-		millisec_counter = OVERFLOW_PER_MILLISEC;
-		millisec_flag = TRUE;
-
-		/*
-		 * This is a secondary millisecond counter that is turned
-		 * on only when we're waiting for a key to be pressed
-		 * and held.  If it times out, then we set a flag to let
-		 * the main loop know that a long press has occurred.
-		 */
-		if (longpress_on) {
-			longpress_counter--;
-			longpress_flag = 0;
-			if (longpress_counter == 0) {
-				longpress_counter = LONGPRESS_TIME;
-				longpress_flag = 1;
-			}
-		}
+	} else {
+		CYCLE_BENCH_MARK(CYCLE_BENCH_SILENT);
+		OCR0A = SINE_MIDPOINT; /* Send 0V to PWM output */
+		/* Keep time so a trunk's 2600 comes back in phase. */
+		tone_a_place += tone_a_step;
+		if(tone_a_place >= (SINE_SAMPLES << STEP_SHIFT))
+			tone_a_place -= (SINE_SAMPLES << STEP_SHIFT);
+		if (gate_samples && --gate_samples == 0)
+			tones_on = !trunk_seized;
 	}
+
+	CYCLE_BENCH_MARK(CYCLE_BENCH_DONE);
+#if DEBUG_LEVEL > 0
+	/*
+	 * Timer 0 counts CPU cycles, so it now holds how long it's been
+	 * since the overflow that got us here.
+	 */
+	if (TCNT0 > isr_cycles_max)
+		isr_cycles_max = TCNT0;
+#endif
 	return;
 } /* ISR(TIM0_OVF_vect) */
 
 
+/*
+ * ISR(TIM1_COMPA_vect)
+ *
+ * Once a millisecond, tell sleep_ms() that time has passed and run the
+ * long press, shift and chirp counters.  The timer has just cleared, so
+ * set up how long this millisecond is.  See TIMER1_PER_MILLISEC.
+ *
+ */
+ISR(TIM1_COMPA_vect)
+{
+	static uint16_t remainder;
+
+	remainder += TIMER1_PER_MILLISEC_REMAINDER;
+	if (remainder >= 1000) {
+		remainder -= 1000;
+		OCR1C = TIMER1_PER_MILLISEC;
+	} else {
+		OCR1C = TIMER1_PER_MILLISEC - 1;
+	}
+
+	millisec_flag = TRUE;
+
+	/*
+	 * This is a secondary millisecond counter that is turned
+	 * on only when we're waiting for a key to be pressed
+	 * and held.  If it times out, then we set a flag to let
+	 * the main loop know that a long press has occurred.
+	 */
+	if (longpress_on) {
+		longpress_counter--;
+		longpress_flag = 0;
+		if (longpress_counter == 0) {
+			longpress_counter = LONGPRESS_TIME;
+			longpress_flag = 1;
+		}
+	}
+
+	/* Close the shift window after a tap of 2600. */
+	if (shift_counter) {
+		if (--shift_counter == 0)
+			shift_on = FALSE;
+	}
+
+#ifdef FAST_BOOT
+	/* Shut off a chirp() when its time is up. */
+	if (chirp_counter) {
+		if (--chirp_counter == 0) {
+			TIMER0_INT_OFF();
+			tones_on = FALSE;
+			OCR0A = SINE_MIDPOINT;	/* Send 0V to PWM output */
+			LED_OFF();
+		}
+	}
+#endif
+
+#if DEBUG_LEVEL > 0
+	trace_send();
+#endif
+	return;
+} /* ISR(TIM1_COMPA_vect) */
+
+
+#if DEBUG_LEVEL > 0
+/*
+ * void trace(uint8_t type, const void *data, uint8_t length)
+ *
+ * Queue a telemetry record.  See TRACE_KEY and friends.
+ *
+ */
+void trace(uint8_t type, const void *data, uint8_t length)
+{
+	const uint8_t *p = data;
+
+	if (BUFFER_SIZE - rbuf_getcount(&tbuf) < length + 1)
+		return;
+	rbuf_insert(&tbuf, (type << 4) | length);
+	while (length--)
+		rbuf_insert(&tbuf, *p++);
+	return;
+} /* void trace(uint8_t type, const void *data, uint8_t length) */
+
+
+/*
+ * void trace_send(void)
+ *
+ * Called from the timer 1 interrupt once a millisecond to put the next
+ * bit of queued telemetry on PB1: a start bit, eight data bits, least
+ * significant first, and a stop bit.
+ *
+ */
+static inline void trace_send(void)
+{
+	static uint8_t data;
+	static uint8_t bit;	/* 0 idle, 1-8 data bits to go, 9 stop */
+
+	if (bit == 0) {
+		if (rbuf_isempty(&tbuf))
+			return;
+		data = rbuf_remove(&tbuf);
+		PORTB &= ~(1 << PB1);	/* start bit */
+		bit = 1;
+	} else if (bit <= 8) {
+		if (data & 1)
+			PORTB |= (1 << PB1);
+		else
+			PORTB &= ~(1 << PB1);
+		data >>= 1;
+		bit++;
+	} else {
+		PORTB |= (1 << PB1);	/* stop bit */
+		bit = 0;
+	}
+	return;
+} /* void trace_send(void) */
+
+
+/*
+ * void stack_paint(void)
+ *
+ * Fill the RAM between the end of the variables and the top of the
+ * stack with STACK_CANARY before main() starts.  This runs from .init1,
+ * before the C runtime has set up the stack, so it must not use any.
+ *
+ */
+extern uint8_t _end;
+extern uint8_t __stack;
+
+void stack_paint(void)
+{
+	uint8_t *p = &_end;
+
+	while (p <= &__stack)
+		*p++ = STACK_CANARY;
+}
+
+
+/*
+ * uint16_t stack_unused(void)
+ *
+ * Count how many bytes above the variables the stack has never
+ * reached.
+ *
+ */
+uint16_t stack_unused(void)
+{
+	const uint8_t *p = &_end;
+	uint16_t count = 0;
+
+	while (*p == STACK_CANARY && p <= &__stack) {
+		p++;
+		count++;
+	}
+	return count;
+} /* uint16_t stack_unused(void) */
+#endif
+
+
+#ifdef SIGMA_DELTA
+/*
+ * uint8_t sigma_delta(int16_t sample)
+ *
+ * Turn a sample from sine_table16 (7 bits finer than the PWM can
+ * show) into a PWM value with a second-order sigma-delta modulator.
+ * The rounding error of each sample is fed back into the next two so
+ * that the noise transfer function is (1 - z^-1)^2.  Nearly all of
+ * the rounding noise ends up well above the voice band, where the
+ * output filter removes it, so the tones come out with several more
+ * effective bits than the 8-bit PWM has.
+ *
+ * The output level is applied here with shifts and adds rather than
+ * separate tables.  The extra bits keep the quieter levels as clean as
+ * full volume.
+ *
+ * Further reading:
+ *    https://en.wikipedia.org/wiki/Delta-sigma_modulation
+ *
+ */
+static inline uint8_t sigma_delta(int16_t sample)
+{
+	static int16_t error1, error2;
+	int16_t wanted;
+	int16_t level;
+
+	switch (volume) {
+	case 1:	sample = (sample >> 1) + (sample >> 3); break;	/* -4.1 dB */
+	case 2:	sample = (sample >> 2) + (sample >> 3) +	/* -8.2 dB */
+			(sample >> 6); break;
+	case 3:	sample = sample >> 2; break;			/* -12 dB */
+	}
+
+	wanted = sample - 2 * error1 + error2;
+	level = (wanted + 64) >> 7;
+	if (level > 127)
+		level = 127;
+	else if (level < -128)
+		level = -128;
+	error2 = error1;
+	error1 = level * 128 - wanted;
+
+	return level + SINE_MIDPOINT;
+} /* uint8_t sigma_delta(int16_t sample) */
+#endif
+
+
 /*
  * Below are functions for implementing a ring buffer.
  * They was adapted from Dean Camera's sample code at
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+#
+# Name:		analyze.py
+# License:	GNU GPL v3
+#
+# Measure the voice-band SINAD of the bluebox's output as modelled by
+# synth.py, at every volume level, with and without the optional
+# output stages.  Everything that isn't one of the tones being played
+# (harmonics, quantization spurs and noise) between 300 Hz and
+# 3400 Hz counts against it.  The low-pass filter on the board takes
+# care of what's above that.
+#
+# Usage:
+#	analyze.py [--tone HZ [HZ]] [--options OPT,...]
+#
+
+import argparse
+import cmath
+import math
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import synth
+
+BAND_LOW = 300
+BAND_HIGH = 3400
+FFT_SIZE = 16384
+SIGNAL_BINS = 8		# either side of a tone, for window leakage
+
+
+def fft(x):
+	"""In-place iterative radix-2 FFT of a list of complex numbers."""
+	n = len(x)
+	j = 0
+	for i in range(1, n):
+		bit = n >> 1
+		while j & bit:
+			j ^= bit
+			bit >>= 1
+		j |= bit
+		if i < j:
+			x[i], x[j] = x[j], x[i]
+	size = 2
+	while size <= n:
+		w = cmath.exp(-2j * math.pi / size)
+		half = size >> 1
+		for start in range(0, n, size):
+			wk = 1
+			for k in range(start, start + half):
+				t = wk * x[k + half]
+				x[k + half] = x[k] - t
+				x[k] += t
+				wk *= w
+		size <<= 1
+	return x
+
+
+def power_spectrum(samples):
+	"""Blackman-Harris windowed power spectrum, DC removed."""
+	n = len(samples)
+	mean = sum(samples) / n
+	a0, a1, a2, a3 = 0.35875, 0.48829, 0.14128, 0.01168
+	x = []
+	for i, s in enumerate(samples):
+		p = 2 * math.pi * i / (n - 1)
+		w = a0 - a1 * math.cos(p) + a2 * math.cos(2 * p) - \
+			a3 * math.cos(3 * p)
+		x.append(complex((s - mean) * w))
+	spec = fft(x)
+	return [abs(c) ** 2 for c in spec[:n // 2]]
+
+
+def sinad(samples, sample_rate, tones):
+	"""In-band SINAD in dB for samples carrying the given tones."""
+	spec = power_spectrum(samples[:FFT_SIZE])
+	bin_hz = sample_rate / FFT_SIZE
+	lo, hi = int(BAND_LOW / bin_hz), int(BAND_HIGH / bin_hz) + 1
+	signal_bins = set()
+	for f in tones:
+		centre = int(round(f / bin_hz))
+		signal_bins.update(range(centre - SIGNAL_BINS,
+					 centre + SIGNAL_BINS + 1))
+	signal = sum(spec[k] for k in signal_bins)
+	noise = sum(spec[k] for k in range(lo, hi) if k not in signal_bins)
+	return 10 * math.log10(signal / noise)
+
+
+def measure(s, tone_a, tone_b, level, options):
+	ms = FFT_SIZE * 1000.0 / s.sample_rate + 1
+	samples = s.render(ms, tone_a, tone_b, level, **options)
+	tones = {s.actual(tone_a), s.actual(tone_b or tone_a)}
+	return sinad(samples, s.sample_rate, tones)
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Measure voice-band SINAD of the modelled bluebox output.")
+	parser.add_argument("--tone", type=float, nargs="+", default=[1717],
+			    help="one or two frequencies in Hz "
+			    "(default: 1717, the UI chirp)")
+	parser.add_argument("--options", default="dither",
+			    help="comma-separated output stages to compare "
+			    "against the plain output (default: dither)")
+	args = parser.parse_args()
+
+	s = synth.Synth()
+	tone_a = args.tone[0]
+	tone_b = args.tone[1] if len(args.tone) > 1 else 0
+	options = [o for o in args.options.split(",") if o]
+
+	print("tone %s Hz, SINAD %d-%d Hz in dB" %
+	      (" + ".join("%g" % t for t in args.tone), BAND_LOW, BAND_HIGH))
+	print("%-8s %8s" % ("level", "plain") +
+	      "".join(" %8s" % o for o in options))
+	for level in range(len(s.tables)):
+		row = [measure(s, tone_a, tone_b, level, {})]
+		for o in options:
+			row.append(measure(s, tone_a, tone_b, level, {o: True}))
+		print("%-8s" % ("-%d dB" % (4 * level) if level else "0 dB") +
+		      "".join(" %8.1f" % r for r in row))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,78 @@
+#
+# Name:		audio.py
+# License:	GNU GPL v3
+#
+# Get the bluebox's output into the host tools as floating point
+# samples between -1 and 1, from either a WAV file or the OCR0A trace
+# in a "make sim" VCD.  OCR0A is written once per timer overflow, so
+# holding each value until the next change gives back the sample
+# stream at the firmware's own sample rate.
+#
+
+import os
+import sys
+import wave
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import synth
+import vcd
+
+
+def read(path):
+	"""Return (sample rate, [samples]) for a .wav or .vcd file."""
+	if path.lower().endswith(".vcd"):
+		return read_vcd(path)
+	return read_wav(path)
+
+
+def read_wav(path):
+	"""8 or 16-bit PCM.  Only the first channel is used."""
+	with wave.open(path, "rb") as w:
+		rate = w.getframerate()
+		width = w.getsampwidth()
+		channels = w.getnchannels()
+		data = w.readframes(w.getnframes())
+	step = width * channels
+	if width == 1:
+		out = [(data[i] - 128) / 128.0 for i in range(0, len(data), step)]
+	elif width == 2:
+		out = [int.from_bytes(data[i:i + 2], "little", signed=True) /
+		       32768.0 for i in range(0, len(data), step)]
+	else:
+		raise ValueError("%s: %d-bit samples not handled" %
+				 (path, 8 * width))
+	return rate, out
+
+
+def read_vcd(path, model=None):
+	"""The OCR0A trace, held between changes and centred on the midpoint."""
+	model = model or synth.Synth()
+	rate = model.sample_rate
+	mid = model.midpoint
+	trace = vcd.find(vcd.read(path), "OCR0A")
+	if not trace:
+		return rate, []
+	count = int(trace[-1][0] * rate) + 1
+	out = [0.0] * count
+	value = mid
+	i = 0
+	for n in range(count):
+		t = n / rate
+		while i < len(trace) and trace[i][0] <= t:
+			value = trace[i][1]
+			i += 1
+		out[n] = (value - mid) / 128.0
+	return rate, out
+
+
+def write_wav(path, rate, samples):
+	"""16-bit mono, clipped at full scale."""
+	data = bytearray(2 * len(samples))
+	for n, v in enumerate(samples):
+		s = max(-32768, min(32767, int(round(v * 32768))))
+		data[2 * n:2 * n + 2] = s.to_bytes(2, "little", signed=True)
+	with wave.open(path, "wb") as w:
+		w.setnchannels(1)
+		w.setsampwidth(2)
+		w.setframerate(int(round(rate)))
+		w.writeframes(bytes(data))
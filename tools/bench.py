@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+#
+# Name:		bench.py
+# License:	GNU GPL v3
+#
+# One line of "make bench": the size of a build and how fast it runs.
+# Reads bluebox.elf for flash and RAM, and the "make sim" trace of a
+# CYCLE_BENCH and SCENARIO build for the rest:
+#
+#	flash	.text plus .data, which is what gets programmed
+#	RAM	.data plus .bss, before any stack
+#	ISR	cycles in the body of ISR(TIM0_OVF_vect) by path, the
+#		same count tools/isrcycles.py makes
+#	latency	from each scripted key press (GPIOR1, see SCENARIO_MARK)
+#		to the first tone sample after it, mean and worst case
+#
+# Keys that don't start a tone before the next key, such as a mode
+# switch, don't count towards latency.
+#
+# Usage:
+#	bench.py --header
+#	bench.py [--f-cpu HZ] [--label NAME] bluebox.elf bluebox.vcd
+#
+
+import argparse
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import elf
+import isrcycles
+import vcd
+
+FORMAT = "%-10s %6s %5s %7s %7s %7s %9s %9s"
+HEADER = ("profile", "flash", "RAM", "silent", "1 tone", "2 tones",
+	  "key mean", "key max")
+TONE_PATHS = (2, 3)		# CYCLE_BENCH_ONE_TONE, CYCLE_BENCH_TWO_TONES
+
+
+def memory(path):
+	"""Return (flash, RAM) bytes for an ELF file."""
+	table = elf.sections(path)[0]
+
+	def size(name):
+		return table[name][2] if name in table else 0
+
+	return size(".text") + size(".data"), size(".data") + size(".bss")
+
+
+def latencies(keys, marks):
+	"""
+	Return the seconds from each key press in the GPIOR1 trace to the
+	first tone path in the GPIOR0 trace.
+	"""
+	tones = [t for t, v in marks if v in TONE_PATHS]
+	presses = [t for (t, v), (_, prev) in zip(keys[1:], keys)
+		   if v != 0 and prev == 0]
+	if keys and keys[0][1] != 0:
+		presses.insert(0, keys[0][0])
+	out = []
+	i = 0
+	for n, start in enumerate(presses):
+		end = presses[n + 1] if n + 1 < len(presses) else None
+		while i < len(tones) and tones[i] < start:
+			i += 1
+		if i < len(tones) and (end is None or tones[i] < end):
+			out.append(tones[i] - start)
+	return out
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Size and speed of one build, for make bench.")
+	parser.add_argument("elf", nargs="?")
+	parser.add_argument("vcd", nargs="?")
+	parser.add_argument("--f-cpu", type=float, default=20e6)
+	parser.add_argument("--label", default="",
+			    help="name for this build, such as the profile")
+	parser.add_argument("--header", action="store_true",
+			    help="print the column headings and exit")
+	args = parser.parse_args()
+
+	if args.header:
+		print(FORMAT % HEADER)
+		return 0
+	if not args.elf or not args.vcd:
+		parser.error("need bluebox.elf and bluebox.vcd")
+
+	flash, ram = memory(args.elf)
+	changes = vcd.read(args.vcd)
+	marks = vcd.find(changes, "GPIOR0")
+	counts = isrcycles.isr_cycles(marks, args.f_cpu)
+	try:
+		keys = vcd.find(changes, "GPIOR1")
+	except KeyError:
+		keys = []
+	lat = latencies(keys, marks)
+
+	def cycles(path):
+		c = counts.get(path)
+		return "%.1f" % (sum(c) / len(c)) if c else "-"
+
+	print(FORMAT % (args.label or os.path.basename(args.elf), flash, ram,
+			cycles(1), cycles(2), cycles(3),
+			"%.2f ms" % (1e3 * sum(lat) / len(lat)) if lat else "-",
+			"%.2f ms" % (1e3 * max(lat)) if lat else "-"))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+#
+# Name:		boottime.py
+# License:	GNU GPL v3
+#
+# Report how long the bluebox takes from reset to its first tone and to
+# being ready for a keystroke, using the VCD written by "make sim".
+#
+# The LEDs on PB1 light whenever a tone plays, so the first rising edge
+# of PB1 is the first tone.  getkey() starts an ADC conversion by
+# setting ADSC, so the first conversion started after the first tone
+# begins is when the keypad is being read again.  With a normal boot
+# that comes after the one-second startup tone.  With FAST_BOOT it
+# comes right away.
+#
+# Usage:
+#	boottime.py bluebox.vcd
+#
+
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import vcd
+
+PB1 = 1 << 1
+ADSC = 1 << 6
+
+
+def main():
+	if len(sys.argv) != 2:
+		sys.exit("usage: %s bluebox.vcd" % sys.argv[0])
+	changes = vcd.read(sys.argv[1])
+	portb = vcd.find(changes, "PORTB")
+	adcsra = vcd.find(changes, "ADCSRA")
+
+	tone = next((t for t, v in portb if v & PB1), None)
+	if tone is None:
+		sys.exit("no tone in trace; run the simulation longer")
+	ready = next((t for t, v in adcsra if t > tone and v & ADSC), None)
+
+	print("first tone:      %8.2f ms" % (tone * 1e3))
+	if ready is None:
+		print("keypad ready:    not within trace")
+	else:
+		print("keypad ready:    %8.2f ms" % (ready * 1e3))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
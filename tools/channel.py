@@ -0,0 +1,466 @@
+#!/usr/bin/env python3
+#
+# Name:		channel.py
+# License:	GNU GPL v3
+#
+# A telephone line between the bluebox and the receiver, for finding
+# out how much margin our tone lengths and levels have.  The samples
+# from synth.py, a WAV file or a "make sim" trace go through, in
+# order:
+#
+#	band	300 to 3400 Hz, two second-order sections each side,
+#		then down to 8 kHz
+#	gain	flat loss or gain, dB
+#	twist	a high shelf at 1200 Hz, so the upper tone of a pair
+#		comes out about this many dB above the lower
+#	offset	frequency shift, Hz, as from an FDM carrier that
+#		doesn't quite match
+#	echo	a delayed copy, ms and dB down
+#	noise	white Gaussian noise, dB relative to a full-scale sine
+#	dropout	the line going dead for a few ms, so many per second
+#	law	G.711 mu-law or A-law, bit for bit as a codec does it
+#
+# Each stage keeps its own state between blocks, so a Channel can be
+# fed a long recording a piece at a time and the result is the same as
+# in one go.  Noise and dropouts come from a seeded generator, so a
+# run can be repeated exactly.  The stages are plain Python loops over
+# each block, not SIMD, so that this runs anywhere the other tools do
+# with nothing to install.
+#
+# With an output file the impaired audio is written as 8 kHz WAV.
+# With --margin the noise is raised in 3 dB steps until
+# tools/decoder.py no longer hears the same signals it heard on the
+# clean input, and the last level that still decoded is reported.
+#
+# --check shifts single tones across the band and exits 1 unless each
+# comes out at f + offset with the image at f - offset at least
+# SHIFT_IMAGE_DB down.
+#
+# Usage:
+#	channel.py [impairments] input.wav|bluebox.vcd output.wav
+#	channel.py [impairments] --margin input.wav|bluebox.vcd ...
+#	channel.py --check
+#
+
+import argparse
+import cmath
+import math
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import audio
+import decoder
+
+RATE = 8000
+BAND = (300, 3400)
+TWIST_HZ = 1200
+HILBERT_TAPS = 63
+MARGIN_FROM = -60		# dB, where --margin starts
+MARGIN_STEP = 3
+SHIFT_IMAGE_DB = 40		# --check, least image suppression
+
+DEFAULTS = {
+	"gain_db": 0.0,
+	"twist_db": 0.0,
+	"offset_hz": 0.0,
+	"echo_ms": 0.0,
+	"echo_db": 20.0,
+	"noise_db": None,
+	"dropouts": 0.0,
+	"dropout_ms": 20.0,
+	"law": "mu",
+	"seed": 1,
+}
+
+
+class Biquad:
+	"""One second-order section, from the Audio EQ Cookbook."""
+
+	def __init__(self, kind, f, rate, q=0.7071, gain_db=0.0):
+		w = 2 * math.pi * f / rate
+		alpha = math.sin(w) / (2 * q)
+		c = math.cos(w)
+		if kind == "lowpass":
+			b = ((1 - c) / 2, 1 - c, (1 - c) / 2)
+			a = (1 + alpha, -2 * c, 1 - alpha)
+		elif kind == "highpass":
+			b = ((1 + c) / 2, -(1 + c), (1 + c) / 2)
+			a = (1 + alpha, -2 * c, 1 - alpha)
+		else:	# highshelf
+			A = 10 ** (gain_db / 40)
+			r = 2 * math.sqrt(A) * alpha
+			b = (A * ((A + 1) + (A - 1) * c + r),
+			     -2 * A * ((A - 1) + (A + 1) * c),
+			     A * ((A + 1) + (A - 1) * c - r))
+			a = ((A + 1) - (A - 1) * c + r,
+			     2 * ((A - 1) - (A + 1) * c),
+			     (A + 1) - (A - 1) * c - r)
+		self.b = [v / a[0] for v in b]
+		self.a = [v / a[0] for v in a[1:]]
+		self.x1 = self.x2 = self.y1 = self.y2 = 0.0
+
+	def process(self, x):
+		b0, b1, b2 = self.b
+		a1, a2 = self.a
+		x1, x2, y1, y2 = self.x1, self.x2, self.y1, self.y2
+		out = [0.0] * len(x)
+		for n, v in enumerate(x):
+			y = b0 * v + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2
+			x2, x1, y2, y1 = x1, v, y1, y
+			out[n] = y
+		self.x1, self.x2, self.y1, self.y2 = x1, x2, y1, y2
+		return out
+
+
+class Resampler:
+	"""Linear interpolation to a new rate, carried across blocks."""
+
+	def __init__(self, rate_in, rate_out):
+		self.step = rate_in / rate_out
+		self.t = 0.0
+		self.prev = 0.0
+
+	def process(self, x):
+		buf = [self.prev] + list(x)
+		last = len(buf) - 1
+		t, step = self.t, self.step
+		out = []
+		while t < last:
+			i = int(t)
+			f = t - i
+			out.append(buf[i] + (buf[i + 1] - buf[i]) * f)
+			t += step
+		self.t = t - last
+		self.prev = buf[-1]
+		return out
+
+
+class Shifter:
+	"""Move every frequency by offset Hz with a Hilbert transformer."""
+
+	def __init__(self, offset, rate):
+		n = HILBERT_TAPS
+		mid = n // 2
+		self.taps = [0.0] * n
+		for k in range(n):
+			m = k - mid
+			if m % 2:
+				window = 0.54 - 0.46 * math.cos(2 * math.pi * k /
+								 (n - 1))
+				self.taps[k] = 2 / (math.pi * m) * window
+		# Only the taps an odd distance from the middle are nonzero.
+		self.odd = [(k, t) for k, t in enumerate(self.taps) if t]
+		self.history = [0.0] * (n - 1)
+		self.w = 2 * math.pi * offset / rate
+		self.phase = 0.0
+
+	def process(self, x):
+		buf = self.history + list(x)
+		n = len(self.taps)
+		mid = n // 2
+		odd = self.odd
+		out = [0.0] * len(x)
+		for i in range(len(x)):
+			q = 0.0
+			for k, t in odd:
+				q += t * buf[i + n - 1 - k]
+			z = complex(buf[i + n - 1 - mid], q) * \
+				cmath.exp(1j * self.phase)
+			out[i] = z.real
+			self.phase = (self.phase + self.w) % (2 * math.pi)
+		self.history = buf[len(buf) - (n - 1):]
+		return out
+
+
+class Echo:
+	def __init__(self, ms, db, rate):
+		self.delay = [0.0] * max(1, int(rate * ms / 1000))
+		self.gain = 10 ** (-db / 20)
+		self.i = 0
+
+	def process(self, x):
+		d, g, i = self.delay, self.gain, self.i
+		out = [0.0] * len(x)
+		for n, v in enumerate(x):
+			out[n] = v + g * d[i]
+			d[i] = v
+			i = (i + 1) % len(d)
+		self.i = i
+		return out
+
+
+def _segment(v, ends):
+	for seg, end in enumerate(ends):
+		if v <= end:
+			return seg
+	return len(ends)
+
+
+def linear2ulaw(pcm):
+	"""16-bit sample to a mu-law byte, as in the Sun reference code."""
+	pcm >>= 2
+	if pcm < 0:
+		pcm, mask = -pcm, 0x7F
+	else:
+		mask = 0xFF
+	pcm = min(pcm, 8159) + 0x21
+	seg = _segment(pcm, (0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF,
+			     0x1FFF))
+	if seg >= 8:
+		return 0x7F ^ mask
+	return ((seg << 4) | ((pcm >> (seg + 1)) & 0xF)) ^ mask
+
+
+def ulaw2linear(u):
+	u = ~u & 0xFF
+	t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4)
+	return 0x84 - t if u & 0x80 else t - 0x84
+
+
+def linear2alaw(pcm):
+	"""16-bit sample to an A-law byte, as in the Sun reference code."""
+	pcm >>= 3
+	if pcm >= 0:
+		mask = 0xD5
+	else:
+		mask = 0x55
+		pcm = -pcm - 1
+	seg = _segment(pcm, (0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF,
+			     0xFFF))
+	if seg >= 8:
+		return 0x7F ^ mask
+	a = seg << 4
+	a |= (pcm >> (1 if seg < 2 else seg)) & 0xF
+	return a ^ mask
+
+
+def alaw2linear(a):
+	a ^= 0x55
+	t = (a & 0x0F) << 4
+	seg = (a & 0x70) >> 4
+	if seg == 0:
+		t += 8
+	else:
+		t = (t + 0x108) << (seg - 1)
+	return t if a & 0x80 else -t
+
+
+_codecs = {}
+
+
+def codec_table(law):
+	"""Every 16-bit sample through the codec and back."""
+	if law not in _codecs:
+		enc, dec = (linear2ulaw, ulaw2linear) if law == "mu" else \
+			(linear2alaw, alaw2linear)
+		back = [dec(b) for b in range(256)]
+		_codecs[law] = [back[enc(v)] for v in range(-32768, 32768)]
+	return _codecs[law]
+
+
+class Channel:
+	def __init__(self, rate, **params):
+		p = dict(DEFAULTS)
+		p.update(params)
+		self.p = p
+		self.stages = [Biquad("highpass", BAND[0], rate),
+			       Biquad("highpass", BAND[0], rate),
+			       Biquad("lowpass", BAND[1], rate),
+			       Biquad("lowpass", BAND[1], rate)]
+		self.resample = Resampler(rate, RATE)
+		self.gain = 10 ** (p["gain_db"] / 20)
+		self.twist = Biquad("highshelf", TWIST_HZ, RATE,
+				    gain_db=p["twist_db"]) \
+			if p["twist_db"] else None
+		self.shift = Shifter(p["offset_hz"], RATE) \
+			if p["offset_hz"] else None
+		self.echo = Echo(p["echo_ms"], p["echo_db"], RATE) \
+			if p["echo_ms"] else None
+		self.random = random.Random(p["seed"])
+		self.noise = None if p["noise_db"] is None else \
+			math.sqrt(0.5) * 10 ** (p["noise_db"] / 20)
+		self.dropout_chance = p["dropouts"] / RATE
+		self.dropout_len = int(RATE * p["dropout_ms"] / 1000)
+		self.dead = 0
+		self.table = codec_table(p["law"]) if p["law"] else None
+
+	def feed(self, x):
+		"""Samples in at the source rate, 8 kHz samples out."""
+		for stage in self.stages:
+			x = stage.process(x)
+		x = self.resample.process(x)
+		g = self.gain
+		if self.twist:
+			# Keep the middle of the band where it was.
+			g *= 10 ** (-self.p["twist_db"] / 40)
+			x = self.twist.process(x)
+		x = [v * g for v in x]
+		if self.shift:
+			x = self.shift.process(x)
+		if self.echo:
+			x = self.echo.process(x)
+		rnd = self.random
+		if self.noise:
+			sigma = self.noise
+			x = [v + rnd.gauss(0, sigma) for v in x]
+		if self.dropout_chance:
+			for n in range(len(x)):
+				if not self.dead and \
+				   rnd.random() < self.dropout_chance:
+					self.dead = self.dropout_len
+				if self.dead:
+					x[n] = 0.0
+					self.dead -= 1
+		if self.table:
+			t = self.table
+			x = [t[max(-32768, min(32767, int(round(v * 32768))))
+			       + 32768] / 32768.0 for v in x]
+		return x
+
+
+def render(rate, samples, block=4096, **params):
+	"""Run a whole recording through a Channel."""
+	ch = Channel(rate, **params)
+	out = []
+	for i in range(0, len(samples), block):
+		out.extend(ch.feed(samples[i:i + block]))
+	return out
+
+
+def names(segs):
+	return [s[0] for s in segs]
+
+
+def margin(rate, samples, params):
+	"""
+	Return (clean signals, worst noise dB that still decodes them,
+	signal level dB) for one recording.
+	"""
+	clean = names(decoder.segments(rate, samples))
+	quiet = dict(params, noise_db=None)
+	out = render(rate, samples, **quiet)
+	if names(decoder.segments(RATE, out)) != clean:
+		return clean, None, None
+	segs = decoder.segments(RATE, out)
+	power = [v * v for s in segs
+		 for v in out[int(s[1] * RATE):int(s[2] * RATE)]]
+	level = 10 * math.log10(2 * sum(power) / len(power)) \
+		if power else None
+	best = None
+	db = MARGIN_FROM
+	while db <= 0:
+		out = render(rate, samples, **dict(params, noise_db=db))
+		if names(decoder.segments(RATE, out)) != clean:
+			break
+		best = db
+		db += MARGIN_STEP
+	return clean, best, level
+
+
+def tone_power(x, f, rate=RATE):
+	"""Mean square of the part of x at f Hz, by Goertzel."""
+	coeff = 2 * math.cos(2 * math.pi * f / rate)
+	s1 = s2 = 0.0
+	for v in x:
+		s1, s2 = v + coeff * s1 - s2, s1
+	return 2 * (s1 * s1 + s2 * s2 - coeff * s1 * s2) / (len(x) * len(x))
+
+
+def check_shift(freqs=(700, 1100, 1700, 2600), offsets=(50, -50)):
+	"""
+	Shift a second of each tone by each offset.  Return a line per
+	pair and whether every one landed at f + offset with the image
+	SHIFT_IMAGE_DB down.
+	"""
+	lines = []
+	ok = True
+	for f in freqs:
+		x = [0.5 * math.sin(2 * math.pi * f * n / RATE)
+		     for n in range(RATE + HILBERT_TAPS)]
+		for offset in offsets:
+			y = Shifter(offset, RATE).process(x)[HILBERT_TAPS:]
+			want = tone_power(y, f + offset)
+			image = tone_power(y, f - offset)
+			db = 10 * math.log10(want / image) if image else math.inf
+			good = db >= SHIFT_IMAGE_DB and \
+				want > 0.9 * tone_power(x[HILBERT_TAPS:], f)
+			ok = ok and good
+			lines.append("%4d Hz %+3d: image %.1f dB down%s" %
+				     (f, offset, db, "" if good else " FAIL"))
+	return lines, ok
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Telephone line impairments for bluebox recordings.")
+	parser.add_argument("files", nargs="*",
+			    help="input [output.wav], or inputs with --margin")
+	parser.add_argument("--gain", type=float, default=0, metavar="DB")
+	parser.add_argument("--twist", type=float, default=0, metavar="DB")
+	parser.add_argument("--offset", type=float, default=0, metavar="HZ")
+	parser.add_argument("--echo", type=float, nargs=2, default=(0, 20),
+			    metavar=("MS", "DB"))
+	parser.add_argument("--noise", type=float, metavar="DB",
+			    help="relative to a full-scale sine")
+	parser.add_argument("--dropouts", type=float, nargs=2,
+			    default=(0, 20), metavar=("PER_S", "MS"))
+	parser.add_argument("--law", choices=("mu", "a", "none"),
+			    default="mu")
+	parser.add_argument("--seed", type=int, default=1)
+	parser.add_argument("--margin", action="store_true",
+			    help="find the noise each input still decodes at")
+	parser.add_argument("--check", action="store_true",
+			    help="check that --offset shifts and doesn't mix")
+	args = parser.parse_args()
+
+	if args.check:
+		lines, ok = check_shift()
+		print("\n".join(lines))
+		return 0 if ok else 1
+	if not args.files:
+		parser.error("need an input file")
+
+	params = {
+		"gain_db": args.gain, "twist_db": args.twist,
+		"offset_hz": args.offset,
+		"echo_ms": args.echo[0], "echo_db": args.echo[1],
+		"noise_db": args.noise,
+		"dropouts": args.dropouts[0], "dropout_ms": args.dropouts[1],
+		"law": None if args.law == "none" else args.law,
+		"seed": args.seed,
+	}
+
+	if not args.margin:
+		if len(args.files) != 2:
+			parser.error("need one input and one output file")
+		rate, samples = audio.read(args.files[0])
+		audio.write_wav(args.files[1], RATE,
+				render(rate, samples, **params))
+		return 0
+
+	status = 0
+	for path in args.files:
+		rate, samples = audio.read(path)
+		clean, best, level = margin(rate, samples, params)
+		if not clean:
+			print("%s: nothing decoded on the clean input" % path)
+			status = 1
+		elif level is None:
+			print("%s: %d signals, lost even without noise" %
+			      (path, len(clean)))
+			status = 1
+		elif best is None:
+			print("%s: %d signals, lost at %d dB of noise" %
+			      (path, len(clean), MARGIN_FROM))
+			status = 1
+		else:
+			print("%s: %d signals decode with noise up to %d dB, "
+			      "%.1f dB below the tones" % (path, len(clean),
+			      best, level - best))
+	return status
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,339 @@
+#!/usr/bin/env python3
+#
+# Name:		corpus.py
+# License:	GNU GPL v3
+#
+# A test corpus that stores how to make each recording rather than the
+# recording itself.  An item is a dial script written like a corpus
+# line for tools/render.py (mode, timing profile and keys), the volume
+# level and build options, the custom profile settings, the line
+# impairments of tools/channel.py and a seed for its noise and
+# dropouts.  That comes to a few dozen bytes where the audio would be
+# hundreds of kilobytes, and rendering it again gives the same samples
+# every time.
+#
+# The file is a header, an index of record offsets and the records:
+#
+#	header	"BBXC", version, item count
+#	index	one 32-bit offset per item
+#	record	RECORD below, then the script in ASCII
+#
+# Corpus() maps the file and reads any item by number without looking
+# at the rest.  render() and stream() make the audio on demand: at the
+# firmware's sample rate for a clean item, or at 8 kHz through the
+# channel when an item has impairments.  stream() goes a tone at a
+# time, so not even a whole item need be in memory.
+#
+# Since nothing but the recipe is stored, a corpus always sounds like
+# the channel.py it is rendered with.  Audio made from an item with an
+# offset before channel.py shifted properly was both sidebands and
+# should be rendered again; the corpus file itself is still good, so
+# the version stays at 1.
+#
+# Usage:
+#	corpus.py build [--random N] [--noise DB ...] [--law LAW ...]
+#		  [--seeds N] [--seed S] [impairments] script.txt|- out.bbc
+#	corpus.py list corpus.bbc [FIRST [LAST]]
+#	corpus.py stat corpus.bbc
+#	corpus.py render corpus.bbc N out.wav
+#
+
+import argparse
+import itertools
+import mmap
+import os
+import random
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import audio
+import channel
+import phonebook
+import render
+import synth
+
+MAGIC = b"BBXC"
+VERSION = 1
+HEADER = struct.Struct("<4sHI")
+OFFSET = struct.Struct("<I")
+# seed, level, options, law, custom tone, gap and seize pause (0xFF for
+# unset, in EEPROM units), gain, twist, offset, noise (tenths of a dB
+# or Hz, NOISE_NONE for none), echo ms, echo dB, dropouts per 100 s,
+# dropout ms, script length
+RECORD = struct.Struct("<I6B4hHhHHB")
+NOISE_NONE = -32768
+OPT_DITHER = 1
+OPT_SIGMA_DELTA = 2
+LAWS = (None, "mu", "a")
+UNSET = 0xFF
+
+
+class Item:
+	"""One recording's recipe."""
+
+	def __init__(self, script, seed=1, level=0, options=0, custom=None,
+		     **impairments):
+		self.script = script
+		self.seed = seed
+		self.level = level
+		self.options = options
+		self.custom = custom or {}	# {tone, gap, seize_pause} ms
+		p = dict(channel.DEFAULTS)
+		p["law"] = None
+		p.update(impairments)
+		p["seed"] = seed
+		self.impairments = p
+
+	def clean(self):
+		"""True if the item goes straight from the synth, no channel."""
+		p = self.impairments
+		return p["law"] is None and p["noise_db"] is None and \
+			not any(p[k] for k in ("gain_db", "twist_db",
+					       "offset_hz", "echo_ms",
+					       "dropouts"))
+
+	def pack(self):
+		p = self.impairments
+		c = self.custom
+		script = self.script.encode("ascii")
+		if len(script) > 255:
+			raise ValueError("script longer than 255 characters")
+
+		def units(key, unit):
+			return UNSET if key not in c else c[key] // unit
+
+		return RECORD.pack(
+			self.seed & 0xFFFFFFFF, self.level, self.options,
+			LAWS.index(p["law"]),
+			units("tone", phonebook.SEQ_LENGTH_UNIT),
+			units("gap", phonebook.SEQ_LENGTH_UNIT),
+			units("seize_pause", 10),
+			round(p["gain_db"] * 10), round(p["twist_db"] * 10),
+			round(p["offset_hz"] * 10),
+			NOISE_NONE if p["noise_db"] is None else
+			round(p["noise_db"] * 10),
+			round(p["echo_ms"]), round(p["echo_db"] * 10),
+			round(p["dropouts"] * 100), round(p["dropout_ms"]),
+			len(script)) + script
+
+	@classmethod
+	def unpack(cls, data, at=0):
+		(seed, level, options, law, tone, gap, seize_pause, gain, twist,
+		 offset, noise, echo_ms, echo_db, dropouts, dropout_ms,
+		 length) = RECORD.unpack_from(data, at)
+		start = at + RECORD.size
+		custom = {}
+		if tone != UNSET:
+			custom["tone"] = tone * phonebook.SEQ_LENGTH_UNIT
+		if gap != UNSET:
+			custom["gap"] = gap * phonebook.SEQ_LENGTH_UNIT
+		if seize_pause != UNSET:
+			custom["seize_pause"] = seize_pause * 10
+		return cls(bytes(data[start:start + length]).decode("ascii"),
+			   seed, level, options, custom,
+			   law=LAWS[law], gain_db=gain / 10, twist_db=twist / 10,
+			   offset_hz=offset / 10,
+			   noise_db=None if noise == NOISE_NONE else noise / 10,
+			   echo_ms=echo_ms, echo_db=echo_db / 10,
+			   dropouts=dropouts / 100, dropout_ms=dropout_ms)
+
+	def describe(self):
+		p = self.impairments
+		bits = ["seed=%d" % self.seed]
+		if self.level:
+			bits.append("level=%d" % self.level)
+		if self.options & OPT_DITHER:
+			bits.append("dither")
+		if self.options & OPT_SIGMA_DELTA:
+			bits.append("sigma-delta")
+		for key, value in sorted(self.custom.items()):
+			bits.append("custom-%s=%d" % (key.replace("_", "-"), value))
+		for key in ("gain_db", "twist_db", "offset_hz", "echo_ms",
+			    "noise_db", "dropouts"):
+			if p[key]:
+				bits.append("%s=%g" % (key, p[key]))
+		if p["echo_ms"]:
+			bits.append("echo_db=%g" % p["echo_db"])
+		if p["dropouts"]:
+			bits.append("dropout_ms=%g" % p["dropout_ms"])
+		if p["law"]:
+			bits.append("law=%s" % p["law"])
+		return "%s  [%s]" % (self.script, " ".join(bits))
+
+
+def write(path, items):
+	"""Write an iterable of Items as a corpus file."""
+	records = [item.pack() for item in items]
+	at = HEADER.size + OFFSET.size * len(records)
+	with open(path, "wb") as f:
+		f.write(HEADER.pack(MAGIC, VERSION, len(records)))
+		for record in records:
+			f.write(OFFSET.pack(at))
+			at += len(record)
+		for record in records:
+			f.write(record)
+	return len(records)
+
+
+class Corpus:
+	"""Random access to the items of a corpus file."""
+
+	def __init__(self, path):
+		self.file = open(path, "rb")
+		self.map = mmap.mmap(self.file.fileno(), 0,
+				     access=mmap.ACCESS_READ)
+		magic, version, self.count = HEADER.unpack_from(self.map, 0)
+		if magic != MAGIC or version != VERSION:
+			raise ValueError("%s: not a version %d corpus" %
+					 (path, VERSION))
+		self.model = synth.Synth()
+		self.seq = render.Sequencer()
+
+	def __len__(self):
+		return self.count
+
+	def __getitem__(self, i):
+		if not 0 <= i < self.count:
+			raise IndexError(i)
+		at, = OFFSET.unpack_from(self.map, HEADER.size + OFFSET.size * i)
+		return Item.unpack(self.map, at)
+
+	def close(self):
+		self.map.close()
+		self.file.close()
+
+	def rate(self, i):
+		return self.model.sample_rate if self[i].clean() else \
+			channel.RATE
+
+	def stream(self, i):
+		"""Yield item i's samples, -1 to 1, a block at a time."""
+		item = self[i]
+		model = self.model
+		mid = model.midpoint
+		plan = self.seq.plan(item.script, custom=item.custom)
+		ch = None if item.clean() else \
+			channel.Channel(model.sample_rate, **item.impairments)
+		for piece in render.pieces(model, plan, item.level,
+					   bool(item.options & OPT_DITHER),
+					   bool(item.options & OPT_SIGMA_DELTA)):
+			x = [(v - mid) / 128.0 for v in piece]
+			yield ch.feed(x) if ch else x
+
+	def render(self, i):
+		"""Return (sample rate, [samples]) for item i."""
+		out = []
+		for block in self.stream(i):
+			out.extend(block)
+		return self.rate(i), out
+
+
+def random_scripts(count, seed):
+	"""MF calls to random 7 to 11 digit numbers."""
+	rnd = random.Random(seed)
+	for _ in range(count):
+		digits = "".join(rnd.choice("0123456789")
+				 for _ in range(rnd.randint(7, 11)))
+		yield "MF S KP %s ST" % digits
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Build and read script-plus-seed test corpora.")
+	sub = parser.add_subparsers(dest="action", required=True)
+
+	b = sub.add_parser("build", help="make a corpus from scripts")
+	b.add_argument("scripts", help="one script per line, or - for stdin")
+	b.add_argument("output")
+	b.add_argument("--random", type=int, metavar="N",
+		       help="add N random MF calls")
+	b.add_argument("--seeds", type=int, default=1,
+		       help="copies of each item, each with its own seed")
+	b.add_argument("--seed", type=int, default=1, help="the first seed")
+	b.add_argument("--level", type=int, nargs="+", default=[0])
+	b.add_argument("--options", default="",
+		       help="DITHER and/or SIGMA_DELTA, comma separated")
+	b.add_argument("--noise", type=float, nargs="+", metavar="DB")
+	b.add_argument("--law", nargs="+", choices=("mu", "a", "none"),
+		       default=["none"])
+	b.add_argument("--gain", type=float, default=0, metavar="DB")
+	b.add_argument("--twist", type=float, default=0, metavar="DB")
+	b.add_argument("--offset", type=float, default=0, metavar="HZ")
+	b.add_argument("--echo", type=float, nargs=2, default=(0, 20),
+		       metavar=("MS", "DB"))
+	b.add_argument("--dropouts", type=float, nargs=2, default=(0, 20),
+		       metavar=("PER_S", "MS"))
+
+	l = sub.add_parser("list", help="print items")
+	l.add_argument("corpus")
+	l.add_argument("first", type=int, nargs="?", default=0)
+	l.add_argument("last", type=int, nargs="?")
+
+	s = sub.add_parser("stat", help="size of a corpus and its audio")
+	s.add_argument("corpus")
+
+	r = sub.add_parser("render", help="write one item as a WAV file")
+	r.add_argument("corpus")
+	r.add_argument("item", type=int)
+	r.add_argument("output")
+	args = parser.parse_args()
+
+	if args.action == "build":
+		f = sys.stdin if args.scripts == "-" else open(args.scripts)
+		scripts = [line.strip() for line in f
+			   if line.strip() and not line.strip().startswith("#")]
+		if args.random:
+			scripts.extend(random_scripts(args.random, args.seed))
+		seq = render.Sequencer()
+		try:
+			for script in scripts:
+				seq.plan(script)
+		except phonebook.BookError as e:
+			sys.exit("%s: %s: %s" % (args.scripts, script, e))
+		opts = args.options.upper().split(",")
+		options = (OPT_DITHER if "DITHER" in opts else 0) | \
+			(OPT_SIGMA_DELTA if "SIGMA_DELTA" in opts else 0)
+		seeds = itertools.count(args.seed)
+
+		def items():
+			for script, level, noise, law, _ in itertools.product(
+					scripts, args.level, args.noise or [None],
+					args.law, range(args.seeds)):
+				yield Item(script, next(seeds), level, options,
+					   law=None if law == "none" else law,
+					   noise_db=noise, gain_db=args.gain,
+					   twist_db=args.twist,
+					   offset_hz=args.offset,
+					   echo_ms=args.echo[0],
+					   echo_db=args.echo[1],
+					   dropouts=args.dropouts[0],
+					   dropout_ms=args.dropouts[1])
+
+		n = write(args.output, items())
+		print("%d items, %d bytes" % (n, os.path.getsize(args.output)))
+		return 0
+
+	corpus = Corpus(args.corpus)
+	if args.action == "list":
+		last = len(corpus) - 1 if args.last is None else args.last
+		for i in range(args.first, min(last, len(corpus) - 1) + 1):
+			print("%d: %s" % (i, corpus[i].describe()))
+	elif args.action == "stat":
+		size = 0
+		for i in range(len(corpus)):
+			plan = corpus.seq.plan(corpus[i].script,
+					       custom=corpus[i].custom)
+			seconds = sum(ms for ms, _, _ in plan) / 1000
+			size += int(seconds * corpus.rate(i)) * 2
+		stored = os.path.getsize(args.corpus)
+		print("%d items in %d bytes, %.1f MB as 16-bit WAV, %.0f to 1" %
+		      (len(corpus), stored, size / 1e6, size / stored))
+	else:
+		rate, samples = corpus.render(args.item)
+		audio.write_wav(args.output, rate, samples)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+#
+# Name:		cycleprof.py
+# License:	GNU GPL v3
+#
+# A gprof for the simulator.  Reads the instruction trace that simavr
+# prints with -t (it has to be built with CONFIG_SIMAVR_TRACE), maps
+# each program counter to a function in bluebox.elf and reports a flat
+# profile and a call graph in CPU cycles.  "make profile" builds the
+# firmware with a scripted SCENARIO of key presses and feeds the trace
+# straight in, so nothing huge lands on disk.
+#
+# Cycles come from the mnemonic on each trace line, using the ATtiny85
+# instruction timings.  Branches and skips are timed by where the next
+# instruction is.  A trace with bare addresses and no mnemonics counts
+# one cycle per instruction instead.  Arriving in the vector table from
+# anywhere else is taken as an interrupt, which costs four cycles and
+# shows up in the call graph as a call from whatever it interrupted.
+#
+# Static inline functions such as the rbuf_* ones are only visible if
+# the build doesn't inline them.  "make profile" adds -fno-inline.
+#
+# Usage:
+#	cycleprof.py [--f-cpu HZ] [--top N] bluebox.elf trace|-
+#
+
+import argparse
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import elf
+
+VECTORS_END = 15 * 2		# ATtiny85: 15 vectors, one rjmp each
+INTERRUPT_CYCLES = 4
+ISR_NAMES = {"__vector_3": "ISR(TIM1_COMPA_vect)",
+	     "__vector_5": "ISR(TIM0_OVF_vect)"}
+
+# Everything not listed takes one cycle.
+CYCLES = {
+	"adiw": 2, "sbiw": 2,
+	"ld": 2, "ldd": 2, "st": 2, "std": 2, "lds": 2, "sts": 2,
+	"push": 2, "pop": 2, "sbi": 2, "cbi": 2,
+	"lpm": 3, "elpm": 3,
+	"rjmp": 2, "ijmp": 2, "jmp": 3,
+	"rcall": 3, "icall": 3, "call": 4,
+	"ret": 4, "reti": 4,
+}
+SKIPS = ("cpse", "sbrc", "sbrs", "sbic", "sbis")
+CALLS = ("rcall", "icall", "call", "eicall")
+ONE_CYCLE = ("add", "adc", "sub", "subi", "sbc", "sbci", "and", "andi", "or",
+	     "ori", "eor", "com", "neg", "inc", "dec", "tst", "clr", "ser",
+	     "cp", "cpc", "cpi", "mov", "movw", "ldi", "in", "out", "lsl",
+	     "lsr", "rol", "ror", "asr", "swap", "bst", "bld", "nop", "sei",
+	     "cli", "sec", "clc", "set", "clt", "sleep", "wdr", "spm")
+MNEMONICS = set(CYCLES) | set(SKIPS) | set(ONE_CYCLE)
+PENDING = "?"			# a call interrupted before its first instruction
+LINE = re.compile(r"\b([0-9a-fA-F]{4,6}):\s*(.*)")
+BRANCH = re.compile(r"^br[a-z]{2}$")
+
+
+def instructions(lines):
+	"""Yield (pc, mnemonic or None) for each traced instruction."""
+	for line in lines:
+		m = LINE.search(line)
+		if not m:
+			continue
+		mnemonic = None
+		for word in m.group(2).split():
+			word = word.rstrip(",").lower()
+			if word in MNEMONICS or BRANCH.match(word):
+				mnemonic = word
+				break
+		yield int(m.group(1), 16), mnemonic
+
+
+def cycles(pc, mnemonic, next_pc):
+	if mnemonic is None:
+		return 1
+	if mnemonic in SKIPS:
+		if next_pc is not None and next_pc - pc in (4, 6):
+			return 1 + (next_pc - pc - 2) // 2
+		return 1
+	if BRANCH.match(mnemonic):
+		return 2 if next_pc is not None and next_pc != pc + 2 else 1
+	return CYCLES.get(mnemonic, 1)
+
+
+class Profile:
+	def __init__(self, symbolize):
+		self.symbolize = symbolize
+		self.total = 0
+		self.self_cycles = {}
+		self.inclusive = {}
+		self.calls = {}
+		self.edges = {}		# (caller, callee): [count, cycles]
+		self.stack = []		# [name, caller, start]
+		self.estimated = False
+
+	def name(self, pc):
+		if pc < VECTORS_END:
+			return "__vectors"
+		name = self.symbolize(pc)
+		return ISR_NAMES.get(name, name)
+
+	def step(self, pc, mnemonic, next_pc):
+		here = self.name(pc)
+		if self.stack and self.stack[-1][0] == PENDING:
+			self.stack[-1][0] = here
+		interrupt = next_pc is not None and \
+			0 < next_pc < VECTORS_END <= pc
+		n = cycles(pc, mnemonic, next_pc)
+		if mnemonic is None:
+			self.estimated = True
+		self.total += n
+		self.self_cycles[here] = self.self_cycles.get(here, 0) + n
+
+		if pc < VECTORS_END and self.stack and \
+		   self.stack[-1][0] is None and next_pc is not None:
+			# The vector's jump tells us which interrupt this is.
+			self.stack[-1][0] = self.name(next_pc)
+		elif mnemonic in CALLS and next_pc is not None:
+			self.stack.append([PENDING if interrupt else
+					   self.name(next_pc), here, self.total])
+		elif mnemonic in ("ret", "reti") and self.stack:
+			self.leave()
+
+		if interrupt:
+			self.total += INTERRUPT_CYCLES
+			self.self_cycles["__vectors"] = \
+				self.self_cycles.get("__vectors", 0) + \
+				INTERRUPT_CYCLES
+			self.stack.append([None, here, self.total - INTERRUPT_CYCLES])
+
+	def leave(self):
+		name, caller, start = self.stack.pop()
+		name = name or "__vectors"
+		spent = self.total - start
+		self.inclusive[name] = self.inclusive.get(name, 0) + spent
+		self.calls[name] = self.calls.get(name, 0) + 1
+		edge = self.edges.setdefault((caller, name), [0, 0])
+		edge[0] += 1
+		edge[1] += spent
+
+	def finish(self):
+		"""Close whatever was still running when the trace ended."""
+		while self.stack:
+			self.leave()
+		for name in self.self_cycles:
+			self.inclusive.setdefault(name, self.self_cycles[name])
+
+
+def report(prof, f_cpu, top):
+	total = prof.total or 1
+	print("%d cycles, %.3f s at %.0f Hz%s" % (prof.total,
+		prof.total / f_cpu, f_cpu,
+		" (one cycle per instruction, no mnemonics in trace)"
+		if prof.estimated else ""))
+	print()
+	print("Flat profile:")
+	print()
+	print("  %self   self cycles    calls   incl cycles  %incl  name")
+	rows = sorted(prof.self_cycles.items(), key=lambda kv: -kv[1])
+	for name, self_cycles in rows[:top]:
+		incl = prof.inclusive.get(name, self_cycles)
+		print("%7.2f %13d %8d %13d %6.2f  %s" % (
+			100.0 * self_cycles / total, self_cycles,
+			prof.calls.get(name, 0), incl, 100.0 * incl / total, name))
+
+	print()
+	print("Call graph:")
+	for name, _ in sorted(prof.inclusive.items(), key=lambda kv: -kv[1])[:top]:
+		print()
+		print("%s  incl %d (%.2f%%) self %d calls %d" % (name,
+			prof.inclusive[name], 100.0 * prof.inclusive[name] / total,
+			prof.self_cycles.get(name, 0), prof.calls.get(name, 0)))
+		for (caller, callee), (count, spent) in sorted(
+				prof.edges.items(), key=lambda kv: -kv[1][1]):
+			if callee == name:
+				print("    from %-28s %8d calls %13d cycles" %
+				      (caller, count, spent))
+		for (caller, callee), (count, spent) in sorted(
+				prof.edges.items(), key=lambda kv: -kv[1][1]):
+			if caller == name and callee != name:
+				print("    to   %-28s %8d calls %13d cycles" %
+				      (callee, count, spent))
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Cycle profile of a simavr instruction trace.")
+	parser.add_argument("elf")
+	parser.add_argument("trace", help="simavr -t output, or - for stdin")
+	parser.add_argument("--f-cpu", type=float, default=20e6)
+	parser.add_argument("--top", type=int, default=25,
+			    help="functions to list (default 25)")
+	args = parser.parse_args()
+
+	prof = Profile(elf.Symbolizer(args.elf))
+	lines = sys.stdin if args.trace == "-" else open(args.trace)
+	prev = None
+	for pc, mnemonic in instructions(lines):
+		if prev is not None:
+			prof.step(prev[0], prev[1], pc)
+		prev = (pc, mnemonic)
+	if prev is not None:
+		prof.step(prev[0], prev[1], None)
+	prof.finish()
+	report(prof, args.f_cpu, args.top)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,134 @@
+#
+# Name:		decoder.py
+# License:	GNU GPL v3
+#
+# A tone receiver for the host tools: MF register signals (R1 and
+# CCITT 5 share the pairs) and the 2400/2600 Hz line signals.  The
+# input is cut into blocks, each block is measured with the Goertzel
+# algorithm at every frequency of interest and named after the tone or
+# pair that holds most of its energy.  Runs of the same name at least
+# MIN_MS long come out as segments.  A one-block dropout inside a run
+# is bridged, the way a real receiver rides through a short hit.
+#
+# Signal names are the bluebox's: digits, KP, ST and, for the pairs
+# that only the 16-key pad sends, KP2, C11 and C12.  tools/switch.py
+# renames them for R1.
+#
+
+import math
+
+BLOCK_MS = 10
+MIN_MS = 30
+BRIDGE_BLOCKS = 1
+DECIMATE_TO = 8000		# Hz, or a little above
+SILENCE = 1e-4			# mean square, -40 dB below full scale
+SHARE = 0.6			# of the block's energy, for a tone to count
+TWIST_DB = 6			# most the weaker of a pair may be down
+
+MF = (700, 900, 1100, 1300, 1500, 1700)
+SF = (2400, 2600)
+PAIRS = {
+	(700, 900): "1", (700, 1100): "2", (900, 1100): "3",
+	(700, 1300): "4", (900, 1300): "5", (1100, 1300): "6",
+	(700, 1500): "7", (900, 1500): "8", (1100, 1500): "9",
+	(1300, 1500): "0", (1100, 1700): "KP", (1500, 1700): "ST",
+	(1300, 1700): "KP2", (700, 1700): "C11", (900, 1700): "C12",
+}
+
+
+class Decoder:
+	def __init__(self, rate, block_ms=BLOCK_MS, min_ms=MIN_MS,
+		     twist_db=TWIST_DB):
+		self.decimate = max(1, int(rate // DECIMATE_TO))
+		self.rate = rate / self.decimate
+		self.block = max(8, int(round(self.rate * block_ms / 1000)))
+		self.block_s = self.block / self.rate
+		self.min_blocks = max(1, int(math.ceil(min_ms / 1000 /
+						       self.block_s)))
+		self.twist = 10 ** (-twist_db / 10)
+		self.coeffs = {f: 2 * math.cos(2 * math.pi * f / self.rate)
+			       for f in MF + SF}
+		self.pending = []	# decimated samples not yet in a block
+		self.acc = []		# raw samples not yet decimated
+		self.blocks = 0
+		self.run = None		# [name, first block, last block, [missed]]
+
+	def power(self, x, f):
+		"""Mean square of the part of x at f Hz."""
+		coeff = self.coeffs[f]
+		s1 = s2 = 0.0
+		for v in x:
+			s1, s2 = v + coeff * s1 - s2, s1
+		return 2 * (s1 * s1 + s2 * s2 - coeff * s1 * s2) / \
+			(len(x) * len(x))
+
+	def classify(self, x):
+		"""Name the signal in one block, or None."""
+		mean = sum(x) / len(x)
+		x = [v - mean for v in x]
+		total = sum(v * v for v in x) / len(x)
+		if total < SILENCE:
+			return None
+		p = {f: self.power(x, f) for f in self.coeffs}
+		if p[2400] + p[2600] > SHARE * total:
+			if min(p[2400], p[2600]) > self.twist * \
+			   max(p[2400], p[2600]):
+				return "2400+2600"
+			return "2600" if p[2600] > p[2400] else "2400"
+		a, b = sorted(MF, key=lambda f: -p[f])[:2]
+		if p[a] + p[b] > SHARE * total and p[b] > self.twist * p[a]:
+			return PAIRS[tuple(sorted((a, b)))]
+		return None
+
+	def feed(self, samples):
+		"""Take more input.  Yields (name, start s, end s) segments."""
+		d = self.decimate
+		acc = self.acc
+		for v in samples:
+			acc.append(v)
+			if len(acc) == d:
+				self.pending.append(sum(acc) / d)
+				acc.clear()
+				if len(self.pending) == self.block:
+					yield from self.step(self.classify(
+						self.pending))
+					self.pending = []
+
+	def step(self, name):
+		n = self.blocks
+		self.blocks += 1
+		run = self.run
+		if run and name == run[0]:
+			run[2] = n
+			run[3] = []
+			return
+		if run and len(run[3]) < BRIDGE_BLOCKS:
+			run[3].append(name)
+			return
+		missed = run[3] if run else []
+		if run:
+			yield from self.close()
+		if name is not None:
+			# Blocks taken as a dropout may have been this
+			# signal starting.
+			start = n
+			while missed and missed[-1] == name:
+				missed.pop()
+				start -= 1
+			self.run = [name, start, n, []]
+
+	def close(self):
+		run, self.run = self.run, None
+		if run and run[2] - run[1] + 1 >= self.min_blocks:
+			yield (run[0], run[1] * self.block_s,
+			       (run[2] + 1) * self.block_s)
+
+	def finish(self):
+		"""Flush the last segment at the end of the input."""
+		yield from self.close()
+
+
+def segments(rate, samples, **kw):
+	"""Decode a whole recording into a list of segments."""
+	dec = Decoder(rate, **kw)
+	return list(dec.feed(samples)) + list(dec.finish())
@@ -0,0 +1,73 @@
+#
+# Name:		elf.py
+# License:	GNU GPL v3
+#
+# Just enough of an ELF reader to get the function symbols out of
+# bluebox.elf, so the host tools don't need avr-nm.  Only 32-bit
+# little-endian files are handled, which is what avr-gcc writes.
+#
+
+import bisect
+import struct
+
+SHT_SYMTAB = 2
+STT_FUNC = 2
+
+
+def sections(path):
+	"""Return {name: (type, offset, size, link)} and the file's bytes."""
+	with open(path, "rb") as f:
+		data = f.read()
+	if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+		raise ValueError("%s: not a 32-bit little-endian ELF file" % path)
+	shoff, = struct.unpack_from("<I", data, 0x20)
+	shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+	headers = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize)
+		   for i in range(shnum)]
+	names = headers[shstrndx]
+
+	def name(offset):
+		start = names[4] + offset
+		return data[start:data.index(b"\0", start)].decode()
+
+	return {name(h[0]): (h[1], h[4], h[5], h[6]) for h in headers}, \
+		headers, data
+
+
+def functions(path):
+	"""Return [(address, size, name)] for the functions, by address."""
+	table, headers, data = sections(path)
+	out = []
+	for sh_type, offset, size, link in table.values():
+		if sh_type != SHT_SYMTAB:
+			continue
+		strtab = headers[link][4]
+		for i in range(0, size, 16):
+			st_name, value, st_size, info, _, shndx = \
+				struct.unpack_from("<IIIBBH", data, offset + i)
+			if info & 0xF != STT_FUNC:
+				continue
+			start = strtab + st_name
+			out.append((value, st_size,
+				    data[start:data.index(b"\0", start)].decode()))
+	return sorted(out)
+
+
+class Symbolizer:
+	"""Map program addresses to the function that holds them."""
+
+	def __init__(self, path):
+		self.funcs = functions(path)
+		self.starts = [a for a, _, _ in self.funcs]
+		self.cache = {}
+
+	def __call__(self, pc):
+		name = self.cache.get(pc)
+		if name is None:
+			i = bisect.bisect_right(self.starts, pc) - 1
+			if i >= 0 and pc < self.funcs[i][0] + max(self.funcs[i][1], 2):
+				name = self.funcs[i][2]
+			else:
+				name = "0x%04x" % pc
+			self.cache[pc] = name
+		return name
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+#
+# Name:		energy.py
+# License:	GNU GPL v3
+#
+# Estimate battery drain from a simavr instruction trace of a SCENARIO
+# build, the same trace tools/cycleprof.py reads.  "make energy" runs
+# one scenario per tone mode through it.
+#
+# The model splits the run into:
+#
+#	idle	cycles spent in sleep_ms() itself, waiting for the clock
+#	active	every other cycle, interrupts included
+#	tone	timer 0 overflows times 256 cycles, since that interrupt
+#		only runs while a tone plays; the LED is lit and the
+#		output stage is driven for this long
+#	ADC	the whole run, since init_adc() never turns it off
+#	EEPROM	one write time per byte written by avr-libc
+#
+# and charges each at the currents below.  They are typical figures
+# for an ATtiny85 at 5 V and 20 MHz from the datasheet curves, and
+# guesses for the LED and output stage.  Change them to suit a board.
+# The firmware busy-waits, so idle cycles draw active current.  The
+# "with idle sleep" line shows what sleeping in sleep_ms() would save.
+# The firmware never powers down, so there is no power-down line.
+#
+# Usage:
+#	energy.py [--f-cpu HZ] [--battery-mah N] [--label NAME] bluebox.elf trace|-
+#
+
+import argparse
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import cycleprof
+import elf
+
+CURRENT_MA = {
+	"active": 11.0,		# CPU running at 20 MHz
+	"idle": 3.5,		# CPU in idle sleep, clocks running
+	"adc": 0.3,		# ADC enabled
+	"eeprom": 3.0,		# EEPROM programming, on top of the CPU
+	"led": 5.0,		# LEDs lit while a tone plays
+	"output": 2.0,		# PWM into the filter and line while a tone plays
+}
+EEPROM_WRITE_S = 3.4e-3
+TICKS_PER_SAMPLE = 256
+TONE_ISR = "ISR(TIM0_OVF_vect)"
+SLEEP = "sleep_ms"
+EEPROM_WRITERS = re.compile(r"^eeprom_write_(byte|r18)$")
+
+
+def model(prof, f_cpu):
+	"""Return the seconds in each state for a finished Profile."""
+	total = prof.total / f_cpu
+	idle = prof.self_cycles.get(SLEEP, 0) / f_cpu
+	writes = sum(n for name, n in prof.calls.items()
+		     if EEPROM_WRITERS.match(name))
+	return {
+		"total": total,
+		"idle": idle,
+		"active": total - idle,
+		"tone": prof.calls.get(TONE_ISR, 0) * TICKS_PER_SAMPLE / f_cpu,
+		"adc": total,
+		"eeprom": writes * EEPROM_WRITE_S,
+		"writes": writes,
+	}
+
+
+def charge(t, idle_sleep):
+	"""Return {item: mA·s} for the states in t."""
+	cpu_idle = CURRENT_MA["idle"] if idle_sleep else CURRENT_MA["active"]
+	return {
+		"CPU active": t["active"] * CURRENT_MA["active"],
+		"CPU idle": t["idle"] * cpu_idle,
+		"ADC": t["adc"] * CURRENT_MA["adc"],
+		"EEPROM": t["eeprom"] * CURRENT_MA["eeprom"],
+		"LED": t["tone"] * CURRENT_MA["led"],
+		"output": t["tone"] * CURRENT_MA["output"],
+	}
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Battery drain estimate from a simavr instruction trace.")
+	parser.add_argument("elf")
+	parser.add_argument("trace", help="simavr -t output, or - for stdin")
+	parser.add_argument("--f-cpu", type=float, default=20e6)
+	parser.add_argument("--battery-mah", type=float, default=500,
+			    help="battery capacity (default 500, a 9 V alkaline)")
+	parser.add_argument("--label", default="",
+			    help="name for this run, such as the scenario")
+	args = parser.parse_args()
+
+	prof = cycleprof.Profile(elf.Symbolizer(args.elf))
+	lines = sys.stdin if args.trace == "-" else open(args.trace)
+	prev = None
+	for pc, mnemonic in cycleprof.instructions(lines):
+		if prev is not None:
+			prof.step(prev[0], prev[1], pc)
+		prev = (pc, mnemonic)
+	if prev is not None:
+		prof.step(prev[0], prev[1], None)
+	prof.finish()
+
+	t = model(prof, args.f_cpu)
+	if t["total"] <= 0:
+		sys.exit("%s: empty trace" % args.trace)
+
+	print("%s%.3f s simulated: %.1f%% idle, tone %.3f s, %d EEPROM "
+	      "bytes written" % (args.label + ": " if args.label else "",
+	      t["total"], 100 * t["idle"] / t["total"], t["tone"], t["writes"]))
+	for title, idle_sleep in (("as built", False),
+				  ("with idle sleep", True)):
+		items = charge(t, idle_sleep)
+		ma = sum(items.values()) / t["total"]
+		print("  %-16s %6.2f mAh per hour, %6.1f h on %.0f mAh  (%s)" % (
+			title, ma, args.battery_mah / ma, args.battery_mah,
+			", ".join("%s %.2f" % (k, v / t["total"])
+				  for k, v in items.items())))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+#
+# Name:		isrcycles.py
+# License:	GNU GPL v3
+#
+# Count the cycles spent in the body of ISR(TIM0_OVF_vect), by path,
+# from the GPIOR0 trace of a CYCLE_BENCH build run under "make sim".
+# The interrupt writes its path to GPIOR0 (see CYCLE_BENCH_MARK) and
+# writes zero on the way out, so the time between the two is the body
+# of the interrupt.  The push/pop prologue and epilogue aren't counted
+# because they happen outside the marks.
+#
+# Usage:
+#	isrcycles.py [--f-cpu HZ] bluebox.vcd
+#
+
+import argparse
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import vcd
+
+PATHS = {1: "silent", 2: "one tone", 3: "two tones"}
+
+
+def isr_cycles(trace, f_cpu):
+	"""Return {path: [cycles, ...]} from a GPIOR0 trace."""
+	counts = {}
+	start = path = None
+	for t, v in trace:
+		if v in PATHS:
+			start, path = t, v
+		elif v == 0 and start is not None:
+			cycles = int(round((t - start) * f_cpu))
+			counts.setdefault(path, []).append(cycles)
+			start = None
+	return counts
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Timer interrupt cycle counts from a CYCLE_BENCH trace.")
+	parser.add_argument("vcd")
+	parser.add_argument("--f-cpu", type=float, default=20e6)
+	args = parser.parse_args()
+
+	counts = isr_cycles(vcd.find(vcd.read(args.vcd), "GPIOR0"), args.f_cpu)
+	if not counts:
+		sys.exit("no CYCLE_BENCH marks in trace; build with "
+			 "-DCYCLE_BENCH")
+	print("%-10s %8s %6s %6s %6s" % ("path", "count", "min", "mean", "max"))
+	for path in sorted(counts):
+		c = counts[path]
+		print("%-10s %8d %6d %6.1f %6d" % (PATHS[path], len(c), min(c),
+						    sum(c) / len(c), max(c)))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
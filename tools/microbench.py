@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+#
+# Name:		microbench.py
+# License:	GNU GPL v3
+#
+# Cost per call of the hot paths, on the AVR and in the host tools that
+# model them, kept as a history so a change that slows one down shows
+# up at the commit that made it.
+#
+# With --avr, reads the "make sim" trace of a MICROBENCH build.  Each
+# kernel in microbench() runs MICROBENCH_REPS times with its number in
+# GPIOR2, so its cycles per call are the time it was marked for, less
+# the empty loop's, over the repetitions.  The numbers and names come
+# from bluebox.c.
+#
+# Without --avr, times the host side: synth.py's sample step and
+# set_tones(), ports of ladder_key() and the key buffer, the slot
+# lookup, render.py's load_timing(), and unpacking a phonebook slot and
+# a corpus record.  These are reported in nanoseconds only, with no
+# cycles column: Python can't read the CPU's cycle counter, and cycles
+# worked out from the nominal clock would only be the nanoseconds
+# scaled.  The AVR's cycle counts are the ones to go by.
+#
+# There is no CRC kernel, because the firmware has no CRC to time.
+#
+# --record appends the run to a JSON lines file, with the commit it
+# was made at.  --compare checks it against the last run of the same
+# side in a file, and exits 1 if a kernel got slower: by any cycle on
+# the AVR, whose counts are exact, or by more than --tolerance on the
+# host, whose aren't.
+#
+# Usage:
+#	microbench.py [--avr bluebox.vcd] [--f-cpu HZ] [--reps N]
+#		      [--record FILE] [--compare FILE] [--tolerance P]
+#
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import corpus
+import phonebook
+import render
+import synth
+import vcd
+
+TOP = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+SOURCE = os.path.join(TOP, "bluebox.c")
+FORMAT = "%-12s %12s %12s"
+HOST_FORMAT = "%-12s %12s"
+
+
+def kernels(source=SOURCE):
+	"""Return (reps, {number: name}) from the MICROBENCH defines."""
+	with open(source) as f:
+		text = f.read()
+	reps = int(re.search(r"^#define\s+MICROBENCH_REPS\s+(\d+)",
+			     text, re.M).group(1))
+	names = {int(n): name.lower() for name, n in re.findall(
+		r"^#define\s+MICROBENCH_(\w+)\s+(\d+)", text, re.M)
+		if name != "REPS"}
+	return reps, names
+
+
+def avr(path, f_cpu, source=SOURCE):
+	"""{kernel: cycles per call} from a GPIOR2 trace."""
+	reps, names = kernels(source)
+	spans = {}
+	start = None
+	for t, v in vcd.find(vcd.read(path), "GPIOR2"):
+		if v in names:
+			start, kernel = t, names[v]
+		elif v == 0 and start is not None:
+			spans[kernel] = (t - start) * f_cpu / reps
+			start = None
+	if "loop" not in spans:
+		raise ValueError("%s: no MICROBENCH marks in GPIOR2" % path)
+	loop = spans.pop("loop")
+	return {k: round(v - loop, 1) for k, v in spans.items()}
+
+
+class Ladder:
+	"""ladder_key(), with its thresholds read out of bluebox.c."""
+
+	def __init__(self, source=SOURCE):
+		with open(source) as f:
+			text = f.read()
+		body = re.search(r"^uint8_t ladder_key\(uint8_t voltage\)\n\{"
+				 r"(.*?)^\}", text, re.S | re.M).group(1)
+		self.floor = int(re.search(r"voltage\s*<\s*(\d+)\)\s*return 0",
+					   body).group(1))
+		self.steps = [(int(lo), int(hi) if hi else 255, key)
+			      for lo, hi, key in re.findall(
+				r"voltage\s*>\s*(\d+)\s*(?:&&\s*voltage\s*<=\s*"
+				r"(\d+)\s*)?\)\s*return\s+(KEY_\w+)", body)]
+
+	def key(self, voltage):
+		if voltage < self.floor:
+			return 0
+		for lo, hi, key in self.steps:
+			if lo < voltage <= hi:
+				return key
+		return "KEY_NOTHING"
+
+
+class Rbuf:
+	"""The key buffer, which is BUFFER_SIZE, one EEPROM chunk, long."""
+
+	def __init__(self, size=phonebook.EEPROM_CHUNK_SIZE):
+		self.buffer = [0] * size
+		self.size = size
+		self.into = self.out = self.count = 0
+
+	def insert(self, data):
+		self.buffer[self.into] = data
+		self.into += 1
+		if self.into == self.size:
+			self.into = 0
+		self.count += 1
+
+	def remove(self):
+		data = self.buffer[self.out]
+		self.out += 1
+		if self.out == self.size:
+			self.out = 0
+		self.count -= 1
+		return data
+
+
+def host(reps):
+	"""{kernel: ns per call} for the host ports."""
+	model = synth.Synth()
+	seq = render.Sequencer()
+	ladder = Ladder()
+	rbuf = Rbuf()
+	mf1, mf2 = seq.freqs["MF1"], seq.freqs["MF2"]
+	book = phonebook.compile_book("startup mode MF\n"
+				      "slot 1 MF KP 5551212 ST\n", "KEYPAD_13")
+	item = corpus.Item("MF S KP 5551212 ST", noise_db=-30,
+			   law="mu").pack()
+	chunks = [phonebook.EEPROM_MEM1 + phonebook.EEPROM_CHUNK_SIZE * n
+		  for n in range(len(phonebook.SLOTS))]
+	slots = phonebook.SLOTS
+	keys = "1234567890*#"
+
+	def one(name, func):
+		func()		# warm up
+		t = time.perf_counter_ns()
+		for i in range(reps):
+			func(i)
+		return name, (time.perf_counter_ns() - t) / reps
+
+	# The sample step is timed over a millisecond of two tones.
+	per = {"isr": len(model.render(1, mf1, mf2))}
+	out = dict([
+		one("loop", lambda i=0: None),
+		one("isr", lambda i=0: model.render(1, mf1, mf2)),
+		one("set_tones", lambda i=0: (model.step(mf1 + i),
+					      model.step(mf2))),
+		one("ladder", lambda i=0: ladder.key(i & 0xFF)),
+		one("rbuf", lambda i=0: (rbuf.insert(i), rbuf.remove())),
+		one("key2chunk", lambda i=0: chunks[slots.index(
+			keys[i % len(keys)])]),
+		one("load_timing", lambda i=0: seq.timing(i & 3)),
+		one("slot_decode", lambda i=0: phonebook.decompile_image(
+			book, "KEYPAD_13")),
+		one("record_decode", lambda i=0: corpus.Item.unpack(item)),
+	])
+	loop = out.pop("loop")
+	return {k: round((v - loop) / per.get(k, 1), 1)
+		for k, v in out.items()}
+
+
+def commit():
+	try:
+		return subprocess.run(["git", "-C", TOP, "rev-parse", "--short",
+				       "HEAD"], capture_output=True, text=True,
+				      check=True).stdout.strip()
+	except (OSError, subprocess.CalledProcessError):
+		return "unknown"
+
+
+def last(path, side):
+	"""The last record for a side in a history file, or None."""
+	found = None
+	try:
+		with open(path) as f:
+			for line in f:
+				if line.strip():
+					record = json.loads(line)
+					if record["side"] == side:
+						found = record
+	except FileNotFoundError:
+		pass
+	return found
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Time the hot paths on the AVR or the host, and track them.")
+	parser.add_argument("--avr", metavar="VCD",
+			    help="a MICROBENCH build's trace")
+	parser.add_argument("--f-cpu", type=float, default=20e6)
+	parser.add_argument("--reps", type=int, default=20000,
+			    help="calls per host kernel")
+	parser.add_argument("--record", metavar="FILE")
+	parser.add_argument("--compare", metavar="FILE")
+	parser.add_argument("--tolerance", type=float, default=15,
+			    help="host slowdown allowed, percent (default 15)")
+	args = parser.parse_args()
+
+	# Read the baseline before this run goes in the same file.
+	side = "avr" if args.avr else "host"
+	before = last(args.compare, side) if args.compare else None
+
+	record = {"commit": commit(), "side": side}
+	print("%s, commit %s" % (side, record["commit"]))
+	if args.avr:
+		cycles = avr(args.avr, args.f_cpu)
+		ns = {k: v * 1e9 / args.f_cpu for k, v in cycles.items()}
+		record["cycles"] = cycles
+		print(FORMAT % ("kernel", "ns/op", "cycles/op"))
+		for k in sorted(ns):
+			print(FORMAT % (k, "%.1f" % ns[k], "%.1f" % cycles[k]))
+	else:
+		ns = host(args.reps)
+		print(HOST_FORMAT % ("kernel", "ns/op"))
+		for k in sorted(ns):
+			print(HOST_FORMAT % (k, "%.1f" % ns[k]))
+	record["ns"] = ns
+
+	if args.record:
+		with open(args.record, "a") as f:
+			f.write(json.dumps(record, sort_keys=True) + "\n")
+
+	worse = []
+	if before:
+		if side == "avr":
+			old, new, allow = before["cycles"], cycles, 0
+		else:
+			old, new = before["ns"], ns
+			allow = args.tolerance / 100
+		for k in sorted(new):
+			if k in old and new[k] > old[k] * (1 + allow) + 0.05:
+				worse.append("%s %.1f -> %.1f" %
+					     (k, old[k], new[k]))
+		print("against %s: %s" % (before["commit"],
+					  "; ".join(worse) or "no regressions"))
+	return 1 if worse else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,438 @@
+#!/usr/bin/env python3
+#
+# Name:		phonebook.py
+# License:	GNU GPL v3
+#
+# Compile a human-readable phonebook into an EEPROM image for the
+# bluebox, or decompile an EEPROM dump back into a phonebook.
+#
+# The image uses the same layout the firmware does: byte 0 is unused,
+# byte 1 is the startup tone mode, byte 2 is the startup tone length,
+# then come twelve chunks of 42 bytes, one per memory key, and then
+# the startup volume, the timing profile of each tone mode and the
+# custom profile.  The first byte of a chunk is the tone mode, with an
+# optional timing profile in its high nibble, and the rest are key
+# codes, escape codes (see SEQ_ESCAPE in bluebox.c) and 0xFF padding.
+#
+# A phonebook looks like this:
+#
+#	# Lines starting with a hash are comments.
+#	startup mode MF
+#	startup length 75
+#	startup volume 0
+#	profile MF spec
+#	custom tone 60
+#
+#	slot 1 MF     KP 2125551212 ST
+#	slot 3 MF/custom KP 2125551212 ST
+#	slot 2 PULSE  S 1 mode=MF KP 0 ST mode=DTMF length=120 5551212
+#	slot # DTMF   *67 5551212
+#	slot 0 MF     slot=2 pause=1500 slot=#
+#
+# Volume 0 is loudest and each step up to 3 is 4 dB quieter.
+# Slots are named after their keys: 1-9, 0, * and #.  Digits may be
+# run together.  KP and ST are aliases for * and # and S or 2600 is
+# the 2600 key.  A, B and C are Code 12, KP2 and Code 11 in MF on
+# either keypad, which a 13-key pad dials as 2600 then 2, 3 or 1.  D
+# exists only on 16-key keypads.  mode=X switches tone mode and
+# length=N (5 to 310 in steps of 5, or "default") changes tone length
+# partway through a sequence.  pause=N waits N ms (100 to 3100 in steps
+# of 100), and slot=K plays slot K, in its own mode and profile, before
+# going on.  Slots may call slots that call slots, up to 3 deep, but
+# never themselves, however far round.
+#
+# The timing profiles are spec, conservative, custom and standard.
+# "profile MODE NAME" sets the profile a tone mode uses.  REDBOX,
+# GREENBOX and TRUNK share one.  A slot may name its own with
+# MODE/NAME.  The custom profile is the standard one with "custom tone
+# N", "custom gap N" (5 to 1270 in steps of 5) and "custom seize-pause
+# N" (10 to 2540 in steps of 10) laid over it.
+#
+# Key codes depend on the keypad, so pass the same --keypad that the
+# Makefile builds with.
+#
+# Usage:
+#	phonebook.py compile [--keypad K] book.txt -o bluebox.eep.hex
+#	phonebook.py decompile [--keypad K] dump.hex
+#
+
+import argparse
+import sys
+
+EEPROM_SIZE = 512
+EEPROM_CHUNK_SIZE = 0x2A
+EEPROM_STARTUP_TONE_MODE = 0x01
+EEPROM_STARTUP_TONE_LENGTH = 0x02
+EEPROM_MEM1 = 0x03
+EEPROM_STARTUP_VOLUME = EEPROM_MEM1 + 12 * 0x2A
+EEPROM_PROFILE_MAP = EEPROM_STARTUP_VOLUME + 1
+EEPROM_CUSTOM = {"tone": (EEPROM_PROFILE_MAP + 1, 5),
+		 "gap": (EEPROM_PROFILE_MAP + 2, 5),
+		 "seize-pause": (EEPROM_PROFILE_MAP + 3, 10)}
+VOLUME_LEVELS = 4
+
+MODES = {"MF": 0x00, "DTMF": 0x01, "REDBOX": 0x02, "GREENBOX": 0x03,
+	 "PULSE": 0x04, "TRUNK": 0x05}
+
+# Timing profile numbers and their two-bit places in the profile map.
+PROFILES = {"spec": 0, "conservative": 1, "custom": 2, "standard": 3}
+PROFILE_SHIFTS = {"MF": 0, "DTMF": 2, "PULSE": 4, "REDBOX": 6,
+		  "GREENBOX": 6, "TRUNK": 6}
+SEQ_MODE_MASK = 0x0F
+SEQ_PROFILE_SHIFT = 4
+
+TONE_LENGTH_FAST = 75
+TONE_LENGTH_SLOW = 120
+
+SEQ_ESCAPE = 0x80
+SEQ_OP_MASK = 0xC0
+SEQ_ARG_MASK = 0x3F
+SEQ_MODE = 0x80
+SEQ_LENGTH = 0xC0
+SEQ_LENGTH_UNIT = 5
+SEQ_CALL = 0x90
+SEQ_CALL_OP_MASK = 0xF0
+SEQ_CALL_MASK = 0x0F
+SEQ_CALL_DEPTH = 3
+SEQ_PAUSE = 0xA0
+SEQ_PAUSE_OP_MASK = 0xE0
+SEQ_PAUSE_MASK = 0x1F
+SEQ_PAUSE_UNIT = 100
+
+# Key names to key codes, mirroring the KEY_* defines in bluebox.c.
+KEYPADS = {
+	"KEYPAD_13": {"1": 1, "2": 2, "3": 3, "4": 4, "5": 5, "6": 6,
+		      "7": 7, "8": 8, "9": 9, "*": 10, "0": 11, "#": 12,
+		      "S": 13, "A": 90, "B": 91, "C": 92, "D": 93},
+	"KEYPAD_13_REV": {"1": 3, "2": 2, "3": 1, "4": 6, "5": 5, "6": 4,
+			  "7": 9, "8": 8, "9": 7, "*": 12, "0": 11, "#": 10,
+			  "S": 13, "A": 90, "B": 91, "C": 92, "D": 93},
+	"KEYPAD_16": {"1": 1, "2": 2, "3": 3, "A": 4, "4": 5, "5": 6,
+		      "6": 7, "B": 8, "7": 9, "8": 10, "9": 11, "C": 12,
+		      "*": 13, "0": 14, "#": 15, "D": 16, "S": 90},
+	"KEYPAD_16_REV": {"1": 4, "2": 3, "3": 2, "A": 1, "4": 8, "5": 7,
+			  "6": 6, "B": 5, "7": 12, "8": 11, "9": 10,
+			  "C": 9, "*": 16, "0": 15, "#": 14, "D": 13,
+			  "S": 90},
+}
+
+# Memory keys in chunk order, as in key2chunk().
+SLOTS = ["1", "2", "3", "4", "5", "6", "7", "8", "9", "*", "0", "#"]
+
+ALIASES = {"KP": "*", "ST": "#", "2600": "S"}
+
+
+class BookError(Exception):
+	pass
+
+
+def mode_name(code):
+	for name, value in MODES.items():
+		if value == code:
+			return name
+	return None
+
+
+def profile_name(number):
+	for name, value in PROFILES.items():
+		if value == number:
+			return name
+	return None
+
+
+def encode_mode(word):
+	"""A slot's MODE or MODE/PROFILE to its first byte."""
+	mode, _, profile = word.upper().partition("/")
+	if mode not in MODES:
+		raise BookError("unknown mode")
+	if not profile:
+		return MODES[mode]
+	if profile.lower() not in PROFILES:
+		raise BookError("unknown profile %s" % profile.lower())
+	return MODES[mode] | \
+		(PROFILES[profile.lower()] + 1) << SEQ_PROFILE_SHIFT
+
+
+def decode_mode(code):
+	name = mode_name(code & SEQ_MODE_MASK)
+	profile = code >> SEQ_PROFILE_SHIFT
+	if name is None or profile > len(PROFILES):
+		return None
+	if profile:
+		name += "/" + profile_name(profile - 1)
+	return name
+
+
+def encode_length(arg):
+	if arg.lower() == "default":
+		return SEQ_LENGTH
+	ms = int(arg)
+	if ms % SEQ_LENGTH_UNIT or not 1 <= ms // SEQ_LENGTH_UNIT <= 62:
+		raise BookError("length must be 5 to 310 in steps of 5")
+	return SEQ_LENGTH | (ms // SEQ_LENGTH_UNIT)
+
+
+def encode_pause(arg):
+	ms = int(arg)
+	if ms % SEQ_PAUSE_UNIT or \
+	   not 1 <= ms // SEQ_PAUSE_UNIT <= SEQ_PAUSE_MASK:
+		raise BookError("pause must be %d to %d in steps of %d" %
+				(SEQ_PAUSE_UNIT, SEQ_PAUSE_MASK * SEQ_PAUSE_UNIT,
+				 SEQ_PAUSE_UNIT))
+	return SEQ_PAUSE | (ms // SEQ_PAUSE_UNIT)
+
+
+def encode_sequence(tokens, keys):
+	out = []
+	for tok in tokens:
+		up = tok.upper()
+		if up.startswith("SLOT="):
+			if tok[5:] not in SLOTS:
+				raise BookError("unknown slot %s" % tok[5:])
+			out.append(SEQ_CALL | SLOTS.index(tok[5:]))
+		elif up.startswith("PAUSE="):
+			out.append(encode_pause(tok[6:]))
+		elif up.startswith("MODE="):
+			if up[5:] not in MODES:
+				raise BookError("unknown mode %s" % tok[5:])
+			out.append(SEQ_MODE | MODES[up[5:]])
+		elif up.startswith("LENGTH="):
+			out.append(encode_length(tok[7:]))
+		elif up in ALIASES:
+			out.append(keys[ALIASES[up]])
+		else:
+			for ch in up:
+				if ch not in keys:
+					raise BookError("unknown key %s" % ch)
+				out.append(keys[ch])
+	if len(out) > EEPROM_CHUNK_SIZE - 1:
+		raise BookError("sequence is %d codes long, limit is %d" %
+				(len(out), EEPROM_CHUNK_SIZE - 1))
+	return out
+
+
+def calls(image, n):
+	"""The slots slot n calls, by number."""
+	chunk = EEPROM_MEM1 + n * EEPROM_CHUNK_SIZE
+	return [code & SEQ_CALL_MASK
+		for code in image[chunk + 1:chunk + EEPROM_CHUNK_SIZE]
+		if code & SEQ_CALL_OP_MASK == SEQ_CALL and
+		code & SEQ_CALL_MASK < len(SLOTS)]
+
+
+def check_calls(image):
+	"""
+	Refuse call chains that the firmware would cut short: a slot that
+	comes back round to itself, or calls more than SEQ_CALL_DEPTH deep.
+	"""
+	def walk(n, path):
+		for m in calls(image, n):
+			if m in path:
+				raise BookError("slot %s calls itself through %s" %
+						(SLOTS[m], " ".join(
+						"slot=" + SLOTS[k] for k in
+						path[path.index(m) + 1:] + [m])))
+			if len(path) > SEQ_CALL_DEPTH:
+				raise BookError("slot %s: calls nest more than "
+						"%d deep" % (SLOTS[path[0]],
+						SEQ_CALL_DEPTH))
+			walk(m, path + [m])
+
+	for n in range(len(SLOTS)):
+		walk(n, [n])
+
+
+def compile_book(text, keypad):
+	keys = KEYPADS[keypad]
+	image = bytearray([0xFF] * EEPROM_SIZE)
+	image[EEPROM_STARTUP_TONE_MODE] = MODES["MF"]
+	image[EEPROM_STARTUP_TONE_LENGTH] = TONE_LENGTH_FAST
+	image[EEPROM_STARTUP_VOLUME] = 0
+
+	for lineno, line in enumerate(text.splitlines(), 1):
+		words = line.split()
+		if not words or words[0].startswith("#"):
+			continue
+		try:
+			if words[0] == "startup" and len(words) == 3:
+				if words[1] == "mode":
+					if words[2].upper() not in MODES:
+						raise BookError("unknown mode")
+					image[EEPROM_STARTUP_TONE_MODE] = \
+						MODES[words[2].upper()]
+				elif words[1] == "length":
+					ms = int(words[2])
+					if ms not in (TONE_LENGTH_FAST,
+						      TONE_LENGTH_SLOW):
+						raise BookError("startup length "
+							"must be %d or %d" %
+							(TONE_LENGTH_FAST,
+							 TONE_LENGTH_SLOW))
+					image[EEPROM_STARTUP_TONE_LENGTH] = ms
+				elif words[1] == "volume":
+					level = int(words[2])
+					if not 0 <= level < VOLUME_LEVELS:
+						raise BookError("startup volume "
+							"must be 0 to %d" %
+							(VOLUME_LEVELS - 1))
+					image[EEPROM_STARTUP_VOLUME] = level
+				else:
+					raise BookError("unknown setting")
+			elif words[0] == "profile" and len(words) == 3:
+				if words[1].upper() not in PROFILE_SHIFTS:
+					raise BookError("unknown mode")
+				if words[2].lower() not in PROFILES:
+					raise BookError("unknown profile")
+				shift = PROFILE_SHIFTS[words[1].upper()]
+				image[EEPROM_PROFILE_MAP] &= ~(3 << shift) & 0xFF
+				image[EEPROM_PROFILE_MAP] |= \
+					PROFILES[words[2].lower()] << shift
+			elif words[0] == "custom" and len(words) == 3:
+				if words[1] not in EEPROM_CUSTOM:
+					raise BookError("unknown setting")
+				addr, unit = EEPROM_CUSTOM[words[1]]
+				ms = int(words[2])
+				if ms % unit or not 1 <= ms // unit <= 254:
+					raise BookError("custom %s must be %d to %d "
+						"in steps of %d" % (words[1], unit,
+						254 * unit, unit))
+				image[addr] = ms // unit
+			elif words[0] == "slot" and len(words) >= 3:
+				if words[1] not in SLOTS:
+					raise BookError("unknown slot")
+				chunk = EEPROM_MEM1 + \
+					SLOTS.index(words[1]) * EEPROM_CHUNK_SIZE
+				codes = [encode_mode(words[2])] + \
+					encode_sequence(words[3:], keys)
+				image[chunk:chunk + len(codes)] = bytes(codes)
+			else:
+				raise BookError("syntax error")
+		except (BookError, ValueError) as e:
+			raise BookError("line %d: %s" % (lineno, e))
+	check_calls(image)
+	return image
+
+
+def decompile_image(image, keypad):
+	names = {v: k for k, v in KEYPADS[keypad].items()}
+	lines = []
+	name = mode_name(image[EEPROM_STARTUP_TONE_MODE])
+	lines.append("startup mode %s" %
+		     (name or "0x%02X" % image[EEPROM_STARTUP_TONE_MODE]))
+	lines.append("startup length %d" % image[EEPROM_STARTUP_TONE_LENGTH])
+	if image[EEPROM_STARTUP_VOLUME] < VOLUME_LEVELS:
+		lines.append("startup volume %d" %
+			     image[EEPROM_STARTUP_VOLUME])
+	for mode in ("MF", "DTMF", "PULSE", "REDBOX"):
+		profile = (image[EEPROM_PROFILE_MAP] >>
+			   PROFILE_SHIFTS[mode]) & 3
+		if profile != PROFILES["standard"]:
+			lines.append("profile %s %s" %
+				     (mode, profile_name(profile)))
+	for setting, (addr, unit) in EEPROM_CUSTOM.items():
+		if image[addr] != 0xFF:
+			lines.append("custom %s %d" % (setting, image[addr] * unit))
+	lines.append("")
+	for n, slot in enumerate(SLOTS):
+		chunk = EEPROM_MEM1 + n * EEPROM_CHUNK_SIZE
+		mem = image[chunk:chunk + EEPROM_CHUNK_SIZE]
+		if decode_mode(mem[0]) is None:
+			continue
+		words = []
+		digits = ""
+		for code in mem[1:]:
+			if code == 0xFF:
+				break
+			if code & SEQ_ESCAPE:
+				if digits:
+					words.append(digits)
+					digits = ""
+				if code & SEQ_CALL_OP_MASK == SEQ_CALL and \
+				   code & SEQ_CALL_MASK < len(SLOTS):
+					words.append("slot=%s" %
+						SLOTS[code & SEQ_CALL_MASK])
+				elif code & SEQ_PAUSE_OP_MASK == SEQ_PAUSE:
+					words.append("pause=%d" %
+						((code & SEQ_PAUSE_MASK) *
+						 SEQ_PAUSE_UNIT))
+				elif (code & SEQ_OP_MASK) == SEQ_MODE:
+					words.append("mode=%s" %
+						(mode_name(code & SEQ_ARG_MASK) or
+						 "0x%02X" % code))
+				elif code == SEQ_LENGTH:
+					words.append("length=default")
+				else:
+					words.append("length=%d" %
+						((code & SEQ_ARG_MASK) *
+						 SEQ_LENGTH_UNIT))
+			elif names.get(code, "?") in "0123456789*#ABCD":
+				digits += names.get(code, "?")
+			else:
+				if digits:
+					words.append(digits)
+					digits = ""
+				words.append(names.get(code, "0x%02X" % code))
+		if digits:
+			words.append(digits)
+		lines.append(("slot %s %-8s %s" %
+			      (slot, decode_mode(mem[0]), " ".join(words))).rstrip())
+	return "\n".join(lines) + "\n"
+
+
+def write_ihex(image, f):
+	for addr in range(0, len(image), 16):
+		rec = bytes([16, addr >> 8, addr & 0xFF, 0]) + \
+			bytes(image[addr:addr + 16])
+		f.write(":%s%02X\n" % (rec.hex().upper(), -sum(rec) & 0xFF))
+	f.write(":00000001FF\n")
+
+
+def read_ihex(f):
+	image = bytearray([0xFF] * EEPROM_SIZE)
+	for lineno, line in enumerate(f, 1):
+		line = line.strip()
+		if not line:
+			continue
+		if not line.startswith(":"):
+			raise BookError("line %d: not Intel HEX" % lineno)
+		rec = bytes.fromhex(line[1:])
+		if sum(rec) & 0xFF:
+			raise BookError("line %d: bad checksum" % lineno)
+		count, addr, rtype = rec[0], (rec[1] << 8) | rec[2], rec[3]
+		if rtype == 1:
+			break
+		if rtype == 0:
+			if addr + count > EEPROM_SIZE:
+				raise BookError("line %d: address out of range"
+						% lineno)
+			image[addr:addr + count] = rec[4:4 + count]
+	return image
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Compile or decompile bluebox EEPROM phonebooks.")
+	parser.add_argument("action", choices=["compile", "decompile"])
+	parser.add_argument("input", help="phonebook or Intel HEX dump")
+	parser.add_argument("-o", "--output", help="output file "
+			    "(default: standard output)")
+	parser.add_argument("--keypad", default="KEYPAD_13",
+			    choices=sorted(KEYPADS))
+	args = parser.parse_args()
+
+	out = open(args.output, "w") if args.output else sys.stdout
+	try:
+		with open(args.input) as f:
+			if args.action == "compile":
+				write_ihex(compile_book(f.read(), args.keypad),
+					   out)
+			else:
+				out.write(decompile_image(read_ihex(f),
+							  args.keypad))
+	except BookError as e:
+		sys.exit("%s: %s" % (args.input, e))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,358 @@
+#!/usr/bin/env python3
+#
+# Name:		render.py
+# License:	GNU GPL v3
+#
+# Render dial strings to WAV files, as the bluebox would play them
+# back from memory.  Each line of the corpus is written like a slot in
+# a phonebook (see tools/phonebook.py), without the slot key:
+#
+#	MF KP 2125551212 ST
+#	MF/spec S KP 0 ST
+#	PULSE 5551212 mode=MF KP 0 ST
+#
+# The sequencer here follows play_chunk() and process_key(): the same
+# timing profiles, read out of bluebox.c, the same escapes and the same
+# pauses.  A line stands alone, so slot= calls can't be rendered.
+# Tones come from synth.py, so the samples are the OCR0A values the
+# firmware would write, and the files are 8-bit WAV at the timer's
+# sample rate.  MF, DTMF and pulse modes are modelled, with the 2600
+# key in any of them.
+#
+# Rendering runs in --jobs worker processes.  Every item's length is
+# known before any of it is rendered, so the output files are sized up
+# front.  With the default mmap writer each worker maps only the part
+# of the output it owns and copies each tone into the mapping as
+# synth.py renders it, with no buffer for the whole item in between.
+# The WAV headers are written last, once everything is in, so an
+# interrupted job leaves files that don't pass for finished ones.  The
+# buffered writer does the same job through ordinary file writes for
+# comparison, and --bench runs both and prints the throughput of each.
+#
+# Usage:
+#	render.py [--jobs N] [--writer mmap|buffered] [--level N]
+#		  (--out DIR | --concat FILE | --bench DIR) corpus.txt
+#
+
+import argparse
+import math
+import mmap
+import multiprocessing
+import os
+import re
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import phonebook
+import synth
+
+TOP = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+HEADER_SIZE = 44
+TIMING_FIELDS = ("tone", "gap", "kp", "seize", "seize_pause", "pulse_tone",
+		 "pulse_gap", "pause")
+MF_KEYS = {"1": ("MF1", "MF2"), "2": ("MF1", "MF3"), "3": ("MF2", "MF3"),
+	   "4": ("MF1", "MF4"), "5": ("MF2", "MF4"), "6": ("MF3", "MF4"),
+	   "7": ("MF1", "MF5"), "8": ("MF2", "MF5"), "9": ("MF3", "MF5"),
+	   "0": ("MF4", "MF5"), "*": ("MF3", "MF6"), "#": ("MF5", "MF6"),
+	   "A": ("MF2", "MF6"), "B": ("MF4", "MF6"), "C": ("MF1", "MF6")}
+DTMF_ROWS = "123A", "456B", "789C", "*0#D"
+
+
+class Sequencer:
+	"""Frequencies and timing profiles from bluebox.c."""
+
+	def __init__(self, source=os.path.join(TOP, "bluebox.c")):
+		with open(source) as f:
+			text = f.read()
+		defines = dict(re.findall(r"^#define\s+(\w+)\s+(\d+)\b", text,
+					  re.M))
+		mults = dict(re.findall(r"^#define\s+(MULT\d)\s+([\d.]+)", text,
+				       re.M))
+		self.freqs = {name: int(int(hz) * float(mults[mult]))
+			      for name, hz, mult in re.findall(
+				r"^#define\s+(\w+)\s+(\d+)\s*\*\s*(MULT\d)",
+				text, re.M)}
+		table = re.search(r"timing_profiles\[PROFILES\] PROGMEM = "
+				  r"\{(.*?)\n\};", text, re.S).group(1)
+		table = re.sub(r"/\*.*?\*/", "", table, flags=re.S)
+		self.profiles = []
+		for row in re.findall(r"\{([^}]*)\}", table):
+			values = [int(defines.get(v.strip(), v.strip()))
+				  for v in row.split(",")]
+			self.profiles.append(dict(zip(TIMING_FIELDS, values)))
+		self.tone_length = int(defines["TONE_LENGTH_FAST"])
+		self.unit = int(defines["SEQ_LENGTH_UNIT"])
+		self.standard = int(defines["PROFILE_STANDARD"])
+
+	def timing(self, profile=None, custom=None):
+		"""load_timing(): custom is {tone, gap, seize_pause} in ms."""
+		t = dict(self.profiles[self.standard if profile is None
+				       else profile])
+		if profile == phonebook.PROFILES["custom"] and custom:
+			t.update(custom)
+		if t["tone"] == 0:
+			t["tone"] = self.tone_length
+		if t["gap"] == 0:
+			t["gap"] = t["tone"]
+		return t
+
+	def plan(self, line, profiles=None, custom=None):
+		"""
+		Turn a corpus line into [(ms, freq_a, freq_b)], with a
+		freq_a of zero for silence.  profiles maps a mode name to
+		the profile it has in EEPROM; standard if not given.
+		"""
+		profiles = profiles or {}
+		words = line.split()
+		code = phonebook.encode_mode(words[0])
+		mode = phonebook.mode_name(code & phonebook.SEQ_MODE_MASK)
+		fixed = code >> phonebook.SEQ_PROFILE_SHIFT
+
+		def load():
+			return self.timing(fixed - 1 if fixed else
+					   profiles.get(mode), custom)
+
+		t = load()
+		out = []
+		for word in words[1:]:
+			up = word.upper()
+			if up.startswith("MODE="):
+				mode = up[5:]
+				if mode not in phonebook.MODES:
+					raise phonebook.BookError("unknown mode %s"
+								  % word[5:])
+				if not fixed:
+					t = load()
+				continue
+			if up.startswith("PAUSE="):
+				code = phonebook.encode_pause(up[6:])
+				out.append(((code & phonebook.SEQ_PAUSE_MASK) *
+					    phonebook.SEQ_PAUSE_UNIT, 0, 0))
+				continue
+			if up.startswith("SLOT="):
+				raise phonebook.BookError("slot= needs the "
+							  "phonebook it calls")
+			if up.startswith("LENGTH="):
+				if up[7:] == "DEFAULT":
+					t = load()
+				else:
+					t["tone"] = t["gap"] = int(up[7:])
+				continue
+			for key in phonebook.ALIASES.get(up, up):
+				out.extend(self.key(key, mode, t))
+		return out
+
+	def key(self, key, mode, t):
+		"""process_key(key, TRUE)."""
+		f = self.freqs
+		if key == "S":
+			return [(t["seize"], f["SEIZE"], f["SEIZE"]),
+				(t["seize_pause"], 0, 0)]
+		if mode == "MF" and key in MF_KEYS:
+			a, b = MF_KEYS[key]
+			return [(t["kp"] if key == "*" else t["tone"], f[a], f[b]),
+				(t["gap"], 0, 0)]
+		if mode == "DTMF":
+			for row, keys in enumerate(DTMF_ROWS):
+				if key in keys:
+					return [(t["tone"],
+						 f["DTMF_ROW%d" % (row + 1)],
+						 f["DTMF_COL%d" %
+						   (keys.index(key) + 1)]),
+						(t["gap"], 0, 0)]
+		if mode == "PULSE" and key.isdigit():
+			out = []
+			for _ in range(int(key) or 10):
+				out.append((t["pulse_tone"], f["SEIZE"],
+					    f["SEIZE"]))
+				out.append((t["pulse_gap"], 0, 0))
+			return out + [(t["pause"], 0, 0)]
+		if mode in ("MF", "DTMF", "PULSE"):
+			raise phonebook.BookError("no key %s in %s" % (key, mode))
+		raise phonebook.BookError("%s mode isn't modelled" % mode)
+
+
+def samples(model, plan):
+	"""How many samples a plan comes to."""
+	return sum(int(ms * model.sample_rate / 1000) for ms, _, _ in plan)
+
+
+def pieces(model, plan, level=0, dither=False, sigma_delta=False):
+	"""Yield the OCR0A values for a plan, as bytes, a tone at a time."""
+	for ms, a, b in plan:
+		if a:
+			yield bytes(model.render(ms, a, b, level, dither,
+						 sigma_delta))
+		else:
+			yield bytes([model.midpoint]) * \
+				int(ms * model.sample_rate / 1000)
+
+
+def render(model, plan, level=0, dither=False, sigma_delta=False):
+	"""The OCR0A values for a plan, as bytes."""
+	return b"".join(pieces(model, plan, level, dither, sigma_delta))
+
+
+def wav_header(rate, count):
+	"""RIFF header for count 8-bit mono samples."""
+	rate = int(round(rate))
+	return struct.pack("<4sI4s4sIHHIIHH4sI", b"RIFF", 36 + count, b"WAVE",
+			   b"fmt ", 16, 1, 1, rate, rate, 1, 8, b"data", count)
+
+
+def write_mmap(path, offset, size, data):
+	"""
+	Copy the pieces of data into size bytes of a file at offset,
+	through a mapping of just that part.
+	"""
+	if not size:
+		return
+	start = offset - offset % mmap.ALLOCATIONGRANULARITY
+	with open(path, "r+b") as f:
+		with mmap.mmap(f.fileno(), offset + size - start,
+			       offset=start) as m:
+			at = offset - start
+			for piece in data:
+				m[at:at + len(piece)] = piece
+				at += len(piece)
+
+
+def write_buffered(path, offset, size, data):
+	with open(path, "r+b") as f:
+		f.seek(offset)
+		for piece in data:
+			f.write(piece)
+
+
+WRITERS = {"mmap": write_mmap, "buffered": write_buffered}
+
+_worker = {}
+
+
+def _init(level, options):
+	_worker["model"] = synth.Synth()
+	_worker["seq"] = Sequencer()
+	_worker["level"] = level
+	_worker["options"] = options
+
+
+def _timed(pieces, clock):
+	"""Pass pieces through, adding the time taken to make them to clock."""
+	while True:
+		start = time.time()
+		piece = next(pieces, None)
+		clock[0] += time.time() - start
+		if piece is None:
+			return
+		yield piece
+
+
+def _job(task):
+	"""Render one item and write it where it belongs."""
+	line, path, offset, size, writer = task
+	clock = [0.0]
+	start = time.time()
+	WRITERS[writer](path, offset, size, _timed(pieces(_worker["model"],
+		_worker["seq"].plan(line), _worker["level"],
+		**_worker["options"]), clock))
+	return clock[0], time.time() - start - clock[0], size
+
+
+def run(lines, out, concat, writer, jobs, level, options):
+	"""
+	Render every line.  Returns (render s, write s, wall s, bytes).
+	"""
+	model = synth.Synth()
+	seq = Sequencer()
+	counts = [samples(model, seq.plan(line)) for line in lines]
+	tasks = []
+	if concat:
+		with open(concat, "wb") as f:
+			f.truncate(HEADER_SIZE + sum(counts))
+		offset = HEADER_SIZE
+		for line, n in zip(lines, counts):
+			tasks.append((line, concat, offset, n, writer))
+			offset += n
+		headers = [(concat, sum(counts))]
+	else:
+		os.makedirs(out, exist_ok=True)
+		width = len(str(len(lines)))
+		headers = []
+		for i, (line, n) in enumerate(zip(lines, counts)):
+			path = os.path.join(out, "%0*d.wav" % (width, i + 1))
+			with open(path, "wb") as f:
+				f.truncate(HEADER_SIZE + n)
+			tasks.append((line, path, HEADER_SIZE, n, writer))
+			headers.append((path, n))
+
+	wall = time.time()
+	with multiprocessing.Pool(jobs, _init, (level, options)) as pool:
+		results = pool.map(_job, tasks, chunksize=max(1, len(tasks) //
+							    (4 * jobs)))
+	for path, n in headers:
+		with open(path, "r+b") as f:
+			f.write(wav_header(model.sample_rate, n))
+	wall = time.time() - wall
+	return (sum(r[0] for r in results), sum(r[1] for r in results), wall,
+		sum(r[2] for r in results))
+
+
+def read_corpus(path):
+	f = sys.stdin if path == "-" else open(path)
+	lines = []
+	for line in f:
+		line = line.strip()
+		if line and not line.startswith("#"):
+			lines.append(line)
+	return lines
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Render dial strings to WAV files as the bluebox plays them.")
+	parser.add_argument("corpus", help="one sequence per line, or -")
+	where = parser.add_mutually_exclusive_group(required=True)
+	where.add_argument("--out", help="directory for one WAV per line")
+	where.add_argument("--concat", help="one WAV with every line in it")
+	where.add_argument("--bench", metavar="DIR", help="render into DIR "
+			   "with each writer and compare")
+	parser.add_argument("--writer", choices=sorted(WRITERS),
+			    default="mmap")
+	parser.add_argument("--jobs", type=int,
+			    default=multiprocessing.cpu_count())
+	parser.add_argument("--level", type=int, default=0,
+			    help="volume level, 0 loudest")
+	parser.add_argument("--options", default="",
+			    help="DITHER and/or SIGMA_DELTA, comma separated")
+	args = parser.parse_args()
+
+	options = {"dither": "DITHER" in args.options.upper().split(","),
+		   "sigma_delta": "SIGMA_DELTA" in args.options.upper().split(",")}
+	seq = Sequencer()
+	lines = read_corpus(args.corpus)
+	try:
+		for line in lines:
+			seq.plan(line)
+	except phonebook.BookError as e:
+		sys.exit("%s: %s" % (args.corpus, e))
+
+	if args.bench:
+		for writer in sorted(WRITERS):
+			r, w, wall, size = run(lines, args.bench, None, writer,
+					       args.jobs, args.level, options)
+			print("%-8s %d files, %.1f MB: wall %.2f s, render %.2f s, "
+			      "write %.3f s, %.1f MB/s written" % (writer,
+			      len(lines), size / 1e6, wall, r, w,
+			      size / 1e6 / w if w else math.inf))
+		return 0
+
+	r, w, wall, size = run(lines, args.out, args.concat, args.writer,
+			       args.jobs, args.level, options)
+	print("%d sequences, %.1f MB in %.2f s" % (len(lines), size / 1e6, wall))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+#
+# Name:		sweep.py
+# License:	GNU GPL v3
+#
+# Find the fastest MF digit timing a receiver still takes reliably.
+# Every digit length and gap in the given ranges, in 5 ms steps as the
+# custom profile stores them, is tried from the fastest up.  Each try
+# renders a test number with render.py and synth.py, sends it down a
+# line from channel.py and decodes it with decoder.py, under every
+# combination of:
+#
+#	--levels	the bluebox's volume levels
+#	--twist		line twist, dB
+#	--mult		frequency calibration, as a factor on what the
+#			MULT1/MULT2 constants give now
+#	--seeds		noise draws
+#
+# A timing passes if the share of tries that decode to exactly the
+# number sent is at least --target.  The first timing that passes is
+# the answer, printed as phonebook lines that tools/phonebook.py will
+# put in EEPROM, with the sweep's results as comments above them.
+# The trials run in --jobs processes.
+#
+# --min-ms is how long the receiver needs a signal to last, which is
+# the main difference between one switch and another.
+#
+# Usage:
+#	sweep.py [--script KEYS] [--tone MIN MAX] [--gap MIN MAX]
+#		 [--levels N ...] [--twist DB ...] [--mult X ...]
+#		 [--seeds N] [--target P] [--noise DB] [--law LAW]
+#		 [--min-ms MS] [--jobs N] [-o phonebook.txt]
+#
+
+import argparse
+import itertools
+import multiprocessing
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import channel
+import decoder
+import phonebook
+import render
+import synth
+
+STEP = phonebook.SEQ_LENGTH_UNIT
+SCRIPT = "KP 1234567890 ST"
+
+_worker = {}
+
+
+def _init():
+	_worker["model"] = synth.Synth()
+	_worker["seq"] = render.Sequencer()
+
+
+def expected(script):
+	"""What the decoder should hear for a script."""
+	out = []
+	for word in script.split():
+		out.extend([word] if word in ("KP", "ST") else list(word))
+	return out
+
+
+def trial(task):
+	"""Render, impair and decode one try.  Returns (timing, passed)."""
+	script, tone, gap, level, twist, mult, seed, noise, law, min_ms = task
+	model = _worker["model"]
+	plan = _worker["seq"].plan("MF/custom " + script,
+				   custom={"tone": tone, "gap": gap})
+	plan = [(ms, int(a * mult), int(b * mult)) for ms, a, b in plan]
+	mid = model.midpoint
+	x = [(v - mid) / 128.0 for v in render.render(model, plan, level)]
+	out = channel.render(model.sample_rate, x, twist_db=twist,
+			     noise_db=noise, law=law, seed=seed)
+	heard = [s[0] for s in decoder.segments(channel.RATE, out,
+						 min_ms=min_ms)]
+	return (tone, gap), heard == expected(script)
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Find the fastest MF timing that still decodes reliably.")
+	parser.add_argument("--script", default=SCRIPT,
+			    help="MF to send (default %s)" % SCRIPT)
+	parser.add_argument("--tone", type=int, nargs=2, default=(30, 120),
+			    metavar=("MIN", "MAX"))
+	parser.add_argument("--gap", type=int, nargs=2, default=(30, 120),
+			    metavar=("MIN", "MAX"))
+	parser.add_argument("--levels", type=int, nargs="+", default=[0])
+	parser.add_argument("--twist", type=float, nargs="+", default=[0])
+	parser.add_argument("--mult", type=float, nargs="+", default=[1.0])
+	parser.add_argument("--seeds", type=int, default=3)
+	parser.add_argument("--target", type=float, default=0.99,
+			    help="share of tries that must decode")
+	parser.add_argument("--noise", type=float, default=-30, metavar="DB")
+	parser.add_argument("--law", choices=("mu", "a", "none"),
+			    default="mu")
+	parser.add_argument("--min-ms", type=int, default=decoder.MIN_MS,
+			    help="shortest signal the receiver takes")
+	parser.add_argument("--jobs", type=int,
+			    default=multiprocessing.cpu_count())
+	parser.add_argument("-o", "--output", help="phonebook lines go here "
+			    "(default: standard output)")
+	args = parser.parse_args()
+
+	script = args.script
+	law = None if args.law == "none" else args.law
+
+	def steps(lo, hi):
+		lo = max(STEP, -(-lo // STEP) * STEP)
+		return range(lo, min(hi, 254 * STEP) + 1, STEP)
+
+	timings = sorted(itertools.product(steps(*args.tone), steps(*args.gap)),
+			 key=lambda tg: (tg[0] + tg[1], tg[0]))
+	conditions = list(itertools.product(args.levels, args.twist, args.mult,
+					    range(args.seeds)))
+	comments = ["# sweep.py: MF %s, %s, noise %g dB, receiver %d ms, "
+		    "target %g%%" % (script, args.law + "-law"
+		    if law else "no codec", args.noise, args.min_ms,
+		    100 * args.target),
+		    "# every timing tried at levels %s, twist %s dB, mult %s, "
+		    "%d seeds" % (" ".join(map(str, args.levels)),
+		    " ".join("%g" % t for t in args.twist),
+		    " ".join("%g" % m for m in args.mult), args.seeds),
+		    "#", "#  tone   gap  decoded"]
+	found = None
+	batch = -(-args.jobs // len(conditions))	# timings at a time
+	with multiprocessing.Pool(args.jobs, _init) as pool:
+		for i in range(0, len(timings), batch):
+			group = timings[i:i + batch]
+			# Every timing sees the same noise, for a fair race.
+			tasks = [(script, tone, gap, level, twist, mult, 1 + seed,
+				  args.noise, law, args.min_ms)
+				 for tone, gap in group
+				 for level, twist, mult, seed in conditions]
+			passed = {}
+			for timing, ok in pool.imap(trial, tasks):
+				passed[timing] = passed.get(timing, 0) + ok
+			for tone, gap in group:
+				share = passed[(tone, gap)] / len(conditions)
+				comments.append("# %5d %5d  %6.1f%%" %
+						(tone, gap, 100 * share))
+				print(comments[-1][2:], file=sys.stderr)
+				if share >= args.target:
+					found = (tone, gap)
+					break
+			if found:
+				break
+
+	out = open(args.output, "w") if args.output else sys.stdout
+	out.write("\n".join(comments) + "\n")
+	if not found:
+		out.write("# nothing in range decoded reliably enough\n")
+		return 1
+	out.write("custom tone %d\ncustom gap %d\nprofile MF custom\n" %
+		  found)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,268 @@
+#!/usr/bin/env python3
+#
+# Name:		switch.py
+# License:	GNU GPL v3
+#
+# The far end of a trunk, for testing sequences without one.  Listens
+# to the bluebox through tools/decoder.py and plays the switch: sees
+# the trunk go idle and seized, winks, collects the number between KP
+# and ST and answers.  The box has no way to hear the replies, so this
+# is closed loop in the sense that every signal is judged by when it
+# arrives against what the switch is doing: digits sent during the
+# wink are lost, a number left hanging times out to reorder, and only
+# a sequence that gets answered counts as complete.
+#
+# Two kinds of trunk:
+#
+#	r1	SF supervision.  2600 for RELEASE_S or longer is on-hook,
+#		and the switch releases.  When it stops the trunk is
+#		seized; the switch winks and then takes KP, digits, ST,
+#		or dial pulses (short 2600 bursts, which is what pulse
+#		mode sends).  900, 1300 and 700+1700 are ST', ST'' and
+#		ST'''.
+#	ss5	CCITT 5.  2400+2600 is clear-forward, answered with
+#		release-guard.  2400 alone seizes, answered with
+#		proceed-to-send.  KP1 or KP2, digits, ST.
+#
+# Each seizure is an attempt.  For each input the log is printed,
+# then the attempts, how many were answered, and the mean and worst
+# time from the start of the 2600 (or clear-forward) that released the
+# trunk to answer.  Several inputs are summed at the end.  --expect
+# makes a route to any other number a failure.
+#
+# Inputs are WAV files or "make sim" traces (bluebox.vcd), decoded as
+# fast as they can be, or at --speed times real time so the log can
+# be watched alongside.  "make switch" runs a SCENARIO build through it.
+#
+# Usage:
+#	switch.py [--protocol r1|ss5] [--expect NUMBER] [--speed X]
+#		  [--quiet] file.wav|bluebox.vcd ...
+#
+
+import argparse
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import audio
+import decoder
+
+RELEASE_S = 0.3			# 2600 this long is on-hook
+WINK_DELAY_S = 0.1
+WINK_S = 0.2
+ANSWER_S = 2.0			# from ST to answer
+INTERDIGIT_S = 5.0		# before a partial number times out
+PULSE_MAX_S = 0.15		# longer 2600 bursts aren't dial pulses
+PULSE_DIGIT_S = 0.3		# gap that ends a pulsed digit
+PULSE_COMPLETE_S = 4.0		# gap that ends a pulsed number
+SS5_MIN_S = 0.1			# line signal recognition
+
+R1_NAMES = {"C12": "ST'", "KP2": "ST''", "C11": "ST'''"}
+R1_ST = ("ST", "ST'", "ST''", "ST'''")
+
+
+class Switch:
+	def __init__(self, protocol="r1", expect=None, log=print):
+		self.protocol = protocol
+		self.expect = expect
+		self.log = log
+		self.state = "talk"	# a call is up when we start listening
+		self.timer = None	# (time, what)
+		self.begin = None	# start of the signal that released us
+		self.number = ""
+		self.pulses = 0
+		self.last = 0.0
+		self.attempts = 0
+		self.times = []
+
+	def event(self, t, what):
+		self.log("%9.3f  %s" % (t, what))
+
+	def fail(self, t, why):
+		self.event(t, "fail: " + why)
+		self.state = "lockout"
+		self.timer = None
+
+	def advance(self, t):
+		"""Fire whatever timer runs out before t."""
+		while self.timer and self.timer[0] <= t:
+			when, what = self.timer
+			self.timer = None
+			if what == "wink":
+				self.event(when, "wink on")
+				self.timer = (when + WINK_S, "ready")
+			elif what == "ready":
+				self.event(when, "wink off, ready for digits"
+					   if self.protocol == "r1" else
+					   "proceed-to-send off, ready")
+				self.state = "ready"
+			elif what == "pulse digit":
+				self.number += str(self.pulses % 10)
+				self.pulses = 0
+				self.event(when, "pulsed digit, %s so far" %
+					   self.number)
+				self.timer = (self.last + PULSE_COMPLETE_S,
+					      "pulse route")
+			elif what == "pulse route":
+				self.route(when)
+			elif what == "answer":
+				self.event(when, "answer")
+				self.state = "answered"
+				self.times.append(when - self.begin)
+			elif what == "timeout":
+				self.fail(when, "partial dial timeout, reorder")
+
+	def release(self, t, begin, what):
+		if self.state != "idle":
+			self.event(t, what)
+		self.state = "idle"
+		self.timer = None
+		self.begin = begin
+
+	def seize(self, t):
+		self.attempts += 1
+		self.number = ""
+		self.pulses = 0
+		self.state = "wink"
+		self.event(t, "seized")
+		if self.protocol == "r1":
+			self.timer = (t + WINK_DELAY_S, "wink")
+		else:
+			self.event(t, "proceed-to-send on")
+			self.timer = (t + WINK_S, "ready")
+
+	def route(self, t):
+		if self.expect is not None and self.number != self.expect:
+			self.fail(t, "routed to %s, not %s" % (self.number,
+							       self.expect))
+			return
+		self.event(t, "route %s" % self.number)
+		self.state = "routing"
+		self.timer = (t + ANSWER_S, "answer")
+
+	def signal(self, name, start, end):
+		"""Take one decoded segment."""
+		self.advance(start)
+		if self.protocol == "r1":
+			self.r1(R1_NAMES.get(name, name), start, end)
+		else:
+			self.ss5(name, start, end)
+		self.advance(end)
+
+	def r1(self, name, start, end):
+		if name == "2600":
+			if end - start >= RELEASE_S:
+				self.release(start + RELEASE_S, start,
+					     "on-hook, released")
+				self.seize(end)
+			elif end - start <= PULSE_MAX_S and \
+			     self.state in ("ready", "pulsing"):
+				self.state = "pulsing"
+				self.pulses += 1
+				self.last = end
+				self.timer = (end + PULSE_DIGIT_S,
+					      "pulse digit")
+			return
+		self.register(name, start, end, ("KP",), R1_ST)
+
+	def ss5(self, name, start, end):
+		if name in ("2400", "2600", "2400+2600") and \
+		   end - start < SS5_MIN_S:
+			return
+		if name == "2400+2600":
+			if self.state != "idle":
+				self.release(end, start, "clear-forward")
+				self.event(end, "release-guard")
+			return
+		if name == "2400":
+			if self.state == "idle":
+				self.seize(end)
+			return
+		self.register(name, start, end, ("KP", "KP2"), ("ST",))
+
+	def register(self, name, start, end, kps, sts):
+		if name in ("2400", "2600", "2400+2600"):
+			return
+		if self.state == "wink":
+			self.fail(start, "%s before %s" % (name,
+				  "start-dial" if self.protocol == "r1" else
+				  "proceed-to-send"))
+		elif self.state in ("ready", "collecting"):
+			if name in kps:
+				self.state = "collecting"
+				self.number = ""
+				self.timer = (end + INTERDIGIT_S, "timeout")
+			elif self.state != "collecting":
+				self.event(start, "%s without KP, ignored" % name)
+			elif name in sts:
+				self.event(start, name)
+				self.route(end)
+			else:
+				self.number += name
+				self.timer = (end + INTERDIGIT_S, "timeout")
+		elif self.state == "pulsing":
+			self.fail(start, "%s while pulse dialing" % name)
+
+	def finish(self, t):
+		self.advance(t)
+
+
+def run(path, args, totals):
+	log = (lambda s: None) if args.quiet else print
+	rate, samples = audio.read(path)
+	sw = Switch(args.protocol, args.expect, log)
+	dec = decoder.Decoder(rate)
+	start = time.time()
+	chunk = int(rate * decoder.BLOCK_MS / 1000)
+	for i in range(0, len(samples), chunk):
+		for seg in dec.feed(samples[i:i + chunk]):
+			sw.signal(*seg)
+		if args.speed > 0:
+			wait = start + (i + chunk) / rate / args.speed - \
+				time.time()
+			if wait > 0:
+				time.sleep(wait)
+	for seg in dec.finish():
+		sw.signal(*seg)
+	sw.finish(len(samples) / rate + INTERDIGIT_S + ANSWER_S)
+
+	report(path, sw.attempts, sw.times)
+	totals[0] += sw.attempts
+	totals[1].extend(sw.times)
+
+
+def report(title, attempts, times):
+	if not attempts:
+		print("%s: no seizures" % title)
+		return
+	print("%s: %d of %d answered (%.0f%%)%s" % (title, len(times),
+		attempts, 100.0 * len(times) / attempts,
+		", time to complete mean %.3f s, max %.3f s" %
+		(sum(times) / len(times), max(times)) if times else ""))
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Play the far end of a trunk to a bluebox recording.")
+	parser.add_argument("inputs", nargs="+",
+			    help="WAV files or bluebox.vcd from make sim")
+	parser.add_argument("--protocol", choices=("r1", "ss5"), default="r1")
+	parser.add_argument("--expect", help="the number every sequence "
+			    "should route to")
+	parser.add_argument("--speed", type=float, default=0,
+			    help="times real time, 0 for as fast as possible")
+	parser.add_argument("--quiet", action="store_true",
+			    help="only print the results")
+	args = parser.parse_args()
+
+	totals = [0, []]
+	for path in args.inputs:
+		run(path, args, totals)
+	if len(args.inputs) > 1:
+		report("total", totals[0], totals[1])
+	return 0 if totals[0] and len(totals[1]) == totals[0] else 1
+
+
+if __name__ == "__main__":
+	sys.exit(main())
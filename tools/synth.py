@@ -0,0 +1,146 @@
+#
+# Name:		synth.py
+# License:	GNU GPL v3
+#
+# A host model of the tone generator in bluebox.c.  It follows
+# ISR(TIM0_OVF_vect) and set_tones() integer for integer, so the
+# samples it renders are the values the firmware would write to OCR0A.
+# The sine tables and constants are read out of bluebox.c and the
+# Makefile rather than copied, so the model can't drift from the
+# firmware.
+#
+
+import os
+import re
+
+TOP = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+
+class Synth:
+	def __init__(self, source=os.path.join(TOP, "bluebox.c"),
+		     makefile=os.path.join(TOP, "Makefile")):
+		with open(source) as f:
+			text = f.read()
+		defines = dict(re.findall(r"^#define\s+(\w+)\s+(\d+)(?:UL?)?\b",
+					  text, re.M))
+		self.sine_samples = int(defines["SINE_SAMPLES"])
+		self.ticks_per_cycle = int(defines["TICKS_PER_CYCLE"])
+		self.step_shift = int(defines["STEP_SHIFT"])
+		self.midpoint = int(re.search(
+			r"^#define\s+SINE_MIDPOINT\s+(0x[0-9a-fA-F]+|\d+)",
+			text, re.M).group(1), 0)
+
+		self.f_cpu = 20000000
+		with open(makefile) as f:
+			m = re.search(r"^F_CPU\s*=\s*(\d+)", f.read(), re.M)
+			if m:
+				self.f_cpu = int(m.group(1))
+		self.sample_rate = self.f_cpu / self.ticks_per_cycle
+
+		m = re.search(r"sine_table\[VOLUME_LEVELS\]\[256\] PROGMEM = "
+			      r"\{(.*?)\n\};", text, re.S)
+		values = [int(v, 16) for v in
+			  re.findall(r"0x[0-9a-fA-F]{2}", m.group(1))]
+		self.tables = [values[i:i + 256]
+			       for i in range(0, len(values), 256)]
+
+		m = re.search(r"sine_table16\[256\] PROGMEM = \{(.*?)\};",
+			      text, re.S)
+		self.table16 = [int(v) for v in
+				re.findall(r"-?\d+", m.group(1))]
+
+		self.samples_per_hertz_times_256 = \
+			(self.sine_samples *
+			 (self.ticks_per_cycle << self.step_shift)) // \
+			(self.f_cpu // 256)
+		self.wrap = self.sine_samples << self.step_shift
+
+	def step(self, freq):
+		"""set_tones(): Hz (truncated to uint32_t) to table step."""
+		tmp = (self.samples_per_hertz_times_256 * int(freq)) \
+			& 0xFFFFFFFF
+		return (tmp // 256) & 0xFFFF
+
+	def actual(self, freq):
+		"""The frequency the firmware really plays for freq."""
+		return self.step(freq) * self.sample_rate / self.wrap
+
+	def render(self, ms, freq_a, freq_b=0, level=0, dither=False,
+		   sigma_delta=False):
+		"""
+		Return the OCR0A values for play(ms, freq_a, freq_b) at the
+		given volume level, one per timer overflow.  dither and
+		sigma_delta follow the DITHER and SIGMA_DELTA build options.
+		"""
+		if sigma_delta:
+			return self.render_sigma_delta(ms, freq_a, freq_b,
+						       level)
+		table = self.tables[level]
+		step_a = self.step(freq_a)
+		step_b = self.step(freq_b if freq_b else freq_a)
+		shift = self.step_shift
+		wrap = self.wrap
+		count = int(ms * self.sample_rate / 1000)
+
+		out = [0] * count
+		place_a = place_b = 0
+		error = 0
+		if step_a == step_b:
+			# The interrupt's single tone path.
+			for n in range(count):
+				out[n] = table[place_a >> shift]
+				place_a += step_a
+				if place_a >= wrap:
+					place_a -= wrap
+			return out
+		for n in range(count):
+			total = table[place_a >> shift] + table[place_b >> shift]
+			if dither:
+				total += error
+				error = total & 1
+			out[n] = total >> 1
+			place_a += step_a
+			place_b += step_b
+			if place_a >= wrap:
+				place_a -= wrap
+			if place_b >= wrap:
+				place_b -= wrap
+		return out
+
+	def render_sigma_delta(self, ms, freq_a, freq_b, level):
+		"""The SIGMA_DELTA build's sample path and sigma_delta()."""
+		table = self.table16
+		step_a = self.step(freq_a)
+		step_b = self.step(freq_b if freq_b else freq_a)
+		shift = self.step_shift
+		wrap = self.wrap
+		mid = self.midpoint
+		count = int(ms * self.sample_rate / 1000)
+
+		out = [0] * count
+		place_a = place_b = 0
+		error1 = error2 = 0
+		for n in range(count):
+			if step_a == step_b:
+				x = table[place_a >> shift]
+			else:
+				x = (table[place_a >> shift] +
+				     table[place_b >> shift]) >> 1
+			if level == 1:
+				x = (x >> 1) + (x >> 3)
+			elif level == 2:
+				x = (x >> 2) + (x >> 3) + (x >> 6)
+			elif level == 3:
+				x = x >> 2
+			wanted = x - 2 * error1 + error2
+			q = max(-128, min(127, (wanted + 64) >> 7))
+			error2 = error1
+			error1 = q * 128 - wanted
+			out[n] = q + mid
+			place_a += step_a
+			place_b += step_b
+			if place_a >= wrap:
+				place_a -= wrap
+			if place_b >= wrap:
+				place_b -= wrap
+		return out
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+# Name:		telemetry.py
+# License:	GNU GPL v3
+#
+# Decode the debug telemetry that a DEBUG_LEVEL > 0 build sends on PB1
+# (see TRACE_KEY in bluebox.c).  It reads either the VCD from
+# "make sim", taking PB1 from the PORTB trace, or a logic analyzer
+# capture exported as CSV with time in seconds in the first column and
+# the PB1 level in the second.  A header line is skipped.
+#
+# --load summarizes the load meter records instead, per tone mode:
+# mean and worst percent busy and the worst main loop latency.
+#
+# Usage:
+#	telemetry.py [--baud N] [--f-cpu HZ] [--load] capture.vcd|capture.csv
+#
+
+import argparse
+import bisect
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import vcd
+
+PB1 = 1 << 1
+
+# type: (name, struct format, field names)
+RECORDS = {
+	0x1: ("key", "<B", ("key",)),
+	0x2: ("play", "<HHH", ("ms", "freq_a", "freq_b")),
+	0x3: ("store", "<B", ("key",)),
+	0x4: ("playback", "<B", ("key",)),
+	0x5: ("stats", "<BH", ("isr_cycles", "stack_unused")),
+	0x6: ("vcc", "<H", ("bandgap",)),
+	0x7: ("load", "<BBB", ("mode", "busy", "latency")),
+}
+
+BANDGAP_MV = 1100	# as in bluebox.c
+TIMER1_PRESCALE = 128		# as in bluebox.c
+MODES = ["MF", "DTMF", "REDBOX", "GREENBOX", "PULSE", "TRUNK"]
+
+
+def read_levels(path):
+	"""Return (times, levels) for the serial line, in time order."""
+	if path.endswith(".vcd"):
+		trace = vcd.find(vcd.read(path), "PORTB")
+		edges = [(t, 1 if v & PB1 else 0) for t, v in trace]
+	else:
+		edges = []
+		with open(path) as f:
+			for line in f:
+				cols = line.replace(";", ",").split(",")
+				try:
+					edges.append((float(cols[0]),
+						      int(float(cols[1]))))
+				except (ValueError, IndexError):
+					continue
+	return [t for t, _ in edges], [v for _, v in edges]
+
+
+def uart_bytes(times, levels, baud):
+	"""Yield (time, byte) for each 8N1 frame on the line."""
+	bit = 1.0 / baud
+
+	def level(t):
+		i = bisect.bisect_right(times, t) - 1
+		return levels[i] if i >= 0 else 1
+
+	i = 1
+	while i < len(times):
+		if levels[i] == 0 and levels[i - 1] == 1:
+			start = times[i]
+			value = 0
+			for n in range(8):
+				value |= level(start + (n + 1.5) * bit) << n
+			if level(start + 9.5 * bit):
+				yield start, value
+			# Skip to the first edge after this frame.
+			i = bisect.bisect_left(times, start + 9.5 * bit)
+		else:
+			i += 1
+
+
+def records(frames):
+	"""Yield (time, name, fields) for each record in the byte stream."""
+	frames = list(frames)
+	i = 0
+	while i < len(frames):
+		t, header = frames[i]
+		kind, length = header >> 4, header & 0x0F
+		payload = bytes(b for _, b in frames[i + 1:i + 1 + length])
+		i += 1 + length
+		if len(payload) < length:
+			break
+		if kind in RECORDS and \
+		   struct.calcsize(RECORDS[kind][1]) == length:
+			name, fmt, fields = RECORDS[kind]
+			yield t, name, dict(zip(fields,
+					       struct.unpack(fmt, payload)))
+		else:
+			yield t, "type%d" % kind, {"data": payload.hex()}
+
+
+def load_report(recs, tick_us):
+	"""Print the load meter records summarized per tone mode."""
+	modes = {}
+	for _, name, fields in recs:
+		if name == "load":
+			modes.setdefault(fields["mode"], []).append(fields)
+	if not modes:
+		print("no load records; is this a DEBUG_LEVEL > 0 build?")
+		return
+	print("%-9s %7s %9s %9s %12s" %
+	      ("mode", "seconds", "mean busy", "max busy", "max latency"))
+	for mode in sorted(modes):
+		rows = modes[mode]
+		busy = [r["busy"] for r in rows]
+		print("%-9s %7d %8.1f%% %8d%% %9.1f us" % (
+			MODES[mode] if mode < len(MODES) else mode, len(rows),
+			sum(busy) / len(busy), max(busy),
+			max(r["latency"] for r in rows) * tick_us))
+
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		"Decode bluebox debug telemetry.")
+	parser.add_argument("capture")
+	parser.add_argument("--baud", type=float, default=1000)
+	parser.add_argument("--f-cpu", type=float, default=20000000)
+	parser.add_argument("--load", action="store_true",
+			    help="summarize the load meter per tone mode")
+	args = parser.parse_args()
+	tick_us = TIMER1_PRESCALE * 1e6 / args.f_cpu
+
+	times, levels = read_levels(args.capture)
+	recs = records(uart_bytes(times, levels, args.baud))
+	if args.load:
+		load_report(recs, tick_us)
+		return 0
+	for t, name, fields in recs:
+		if name == "vcc" and fields["bandgap"]:
+			fields["mV"] = BANDGAP_MV * 1024 // fields["bandgap"]
+		if name == "load":
+			fields["latency_us"] = "%.1f" % \
+				(fields["latency"] * tick_us)
+		print("%10.3f  %-9s %s" % (t, name, " ".join(
+			"%s=%s" % kv for kv in fields.items())))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
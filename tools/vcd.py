@@ -0,0 +1,70 @@
+#
+# Name:		vcd.py
+# License:	GNU GPL v3
+#
+# Just enough of a Value Change Dump reader to pick apart the traces
+# that "make sim" gets out of simavr.
+#
+
+TIMESCALES = {"s": 1.0, "ms": 1e-3, "us": 1e-6, "ns": 1e-9, "ps": 1e-12,
+	      "fs": 1e-15}
+
+
+def read(path):
+	"""
+	Return a dict mapping each signal name to a list of
+	(seconds, value) changes in time order.  Values that aren't plain
+	binary (x, z) are dropped.
+	"""
+	names = {}
+	changes = {}
+	scale = 1e-9
+	now = 0
+	with open(path) as f:
+		tokens = f.read().split()
+	i = 0
+	while i < len(tokens):
+		tok = tokens[i]
+		if tok == "$timescale":
+			spec = []
+			i += 1
+			while tokens[i] != "$end":
+				spec.append(tokens[i])
+				i += 1
+			spec = "".join(spec)
+			num = spec.rstrip("afnpumsAFNPUMS")
+			scale = int(num or 1) * TIMESCALES[spec[len(num):]]
+		elif tok == "$var":
+			# $var <type> <size> <id> <name> [range] $end
+			ident, name = tokens[i + 3], tokens[i + 4]
+			names[ident] = name
+			changes.setdefault(name, [])
+			while tokens[i] != "$end":
+				i += 1
+		elif tok.startswith("$"):
+			if tok not in ("$end", "$dumpvars"):
+				while tokens[i] != "$end":
+					i += 1
+		elif tok.startswith("#"):
+			now = int(tok[1:])
+		elif tok[0] in "bB":
+			ident = tokens[i + 1]
+			i += 1
+			if ident in names:
+				try:
+					changes[names[ident]].append(
+						(now * scale, int(tok[1:], 2)))
+				except ValueError:
+					pass
+		elif tok[0] in "01" and tok[1:] in names:
+			changes[names[tok[1:]]].append((now * scale, int(tok[0])))
+		i += 1
+	return changes
+
+
+def find(changes, name):
+	"""Look up a signal by name, ignoring any scope prefix."""
+	for key in changes:
+		if key == name or key.split(".")[-1] == name:
+			return changes[key]
+	raise KeyError("no signal named %s in trace" % name)